@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include <audio_stats.hpp>
+#include <pcm_format.hpp>
+
+/*
+ * On-disk cache of custom audio after decoding, conversion to the stream
+ * format and the fade-in. Entries are keyed by path, mtime, size, target
+ * format and fade length, and are mapped straight into memory on a hit.
+ *
+ * The directory is kept under limit bytes by evicting the least recently
+ * used entries; a hit bumps the entry's mtime since atime is often off.
+ */
+class audio_cache {
+public:
+	static constexpr uintmax_t default_limit = uintmax_t{256} << 20;
+
+	// trims the directory to limit right away, counting what it removes in stats
+	explicit audio_cache(std::filesystem::path directory = default_directory(), uintmax_t limit = default_limit,
+						 audio_stats* stats = nullptr);
+
+	// $XDG_CACHE_HOME/tystnad, ~/.cache/tystnad or ~/Library/Caches/tystnad on macOS
+	static std::filesystem::path default_directory();
+
+	// throws like load_wav() when the file cannot be read; cache failures only fall back to decoding
+	pcm_buffer load(const std::string& file_path, const pcm_format& target, std::chrono::milliseconds fade_in);
+
+	audio_stats* stats = nullptr;
+
+private:
+	pcm_buffer map_entry(const std::filesystem::path& entry, const std::string& key) const;
+	void       store(const std::filesystem::path& entry, const std::string& key, const pcm_buffer& buffer) const;
+	void       evict(const std::filesystem::path& keep) const;
+
+	std::filesystem::path directory;
+	uintmax_t             limit;
+
+	// the most recent entry, handed out again while the file is unchanged
+	std::string last_key;
+	pcm_buffer  last;
+};
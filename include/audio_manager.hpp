@@ -7,106 +7,200 @@
 #include <alsa/asoundlib.h>
 #endif
 #include <fstream>
+#include <iostream>
 #include <vector>
 #include <thread>
 #include <filesystem>
 #include <audio_manager.hpp>
 #include <stdexcept>
 #include <cstring>
+#include <functional>
+#include <audio_stats.hpp>
+#include <supervisor.hpp>
+#include <trace.hpp>
+#include <wav.hpp>
 
 #ifdef MACOS
 class audio_manager {
     AudioQueueRef queue{};
+    std::vector<AudioQueueBufferRef> buffers;
     AudioStreamBasicDescription format{};
-    std::vector<char> buffer;
-    size_t offset = 0;
+    pcm_buffer buffer;
+    size_t offset = 0; // in frames
+    bool stopped = false;
 
     static void AQCallback(void* data, AudioQueueRef aq, AudioQueueBufferRef buf) {
     	auto* player = static_cast<audio_manager*>(data);
 
-    	size_t bytes = std::min(
-			static_cast<size_t>(buf->mAudioDataBytesCapacity),
-			player->buffer.size() - player->offset
-		);
+    	const size_t frame_bytes = player->buffer.format.frame_bytes();
+    	const size_t data_frames = player->buffer.data_frames();
+    	const size_t capacity = buf->mAudioDataBytesCapacity / frame_bytes;
+    	auto* out = static_cast<char*>(buf->mAudioData);
 
-        if (bytes > 0) {
-            memcpy(buf->mAudioData, player->buffer.data() + player->offset, bytes);
-            buf->mAudioDataByteSize = static_cast<uint32_t>(bytes);
-            player->offset += bytes;
+    	size_t filled = 0;
+    	while (data_frames > 0 && filled < capacity && player->offset < player->buffer.frames) {
+    		const size_t pos = player->offset % data_frames;
+    		const size_t frames = std::min({capacity - filled, player->buffer.frames - player->offset, data_frames - pos});
 
+    		memcpy(out + filled * frame_bytes, player->buffer.bytes() + pos * frame_bytes, frames * frame_bytes);
+    		filled += frames;
+    		player->offset += frames;
+    	}
+
+        if (filled > 0) {
+            buf->mAudioDataByteSize = static_cast<uint32_t>(filled * frame_bytes);
+
+            trace_span span("AudioQueueEnqueueBuffer");
+            span.set_arg("frames", static_cast<int64_t>(filled));
             AudioQueueEnqueueBuffer(aq, buf, 0, nullptr);
+
+            if (player->stats) {
+                player->stats->writes++;
+                player->stats->frames_written += filled;
+                player->log_resume();
+            }
         } else {
             AudioQueueStop(aq, false);
         }
     }
+    void log_resume() const {
+        if (const int64_t ns = stats->first_frame_after_resume()) {
+            std::cerr << "First frame " << ns / 1000000.0 << " ms after resume\n";
+        }
+    }
 public:
-    bool init(const std::vector<char>& data) {
+    audio_stats* stats = nullptr;
+    std::function<bool()> interrupted;
+    std::function<bool()> suspended; // the system is about to sleep; let go of the device
+    std::function<void()> released;
+
+    bool init(const pcm_buffer& data) {
         buffer = data;
         offset = 0;
 
-        format.mSampleRate = 44100;
+        const bool is_float = data.format.format == sample_format::float32;
+
+        format.mSampleRate = data.format.rate;
         format.mFormatID = kAudioFormatLinearPCM;
-        format.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
-        format.mBitsPerChannel = 16;
-        format.mChannelsPerFrame = 2;
-        format.mBytesPerPacket = format.mBytesPerFrame = (format.mBitsPerChannel / 8) * format.mChannelsPerFrame;
+        format.mFormatFlags = (is_float ? kAudioFormatFlagIsFloat : kAudioFormatFlagIsSignedInteger) | kAudioFormatFlagIsPacked;
+        format.mBitsPerChannel = static_cast<UInt32>(data.format.sample_bytes() * 8);
+        format.mChannelsPerFrame = data.format.channels();
+        format.mBytesPerPacket = format.mBytesPerFrame = static_cast<UInt32>(data.format.frame_bytes());
         format.mFramesPerPacket = 1;
         format.mReserved = 0;
 
+        trace_span span("open");
+
         OSStatus status = AudioQueueNewOutput(&format, AQCallback, this, nullptr, nullptr, 0, &queue);
         if (status != noErr) {
-            throw std::runtime_error{"AudioQueueNewOutput failed: " + std::to_string(status)};
+            throw audio_error{"AudioQueueNewOutput failed: " + std::to_string(status), status};
+        }
+
+        if (data.format.layout != channel_layout::stereo) {
+            AudioChannelLayout layout{};
+            layout.mChannelLayoutTag = data.format.layout == channel_layout::surround_51
+                ? kAudioChannelLayoutTag_WAVE_5_1_A
+                : kAudioChannelLayoutTag_WAVE_7_1;
+
+            status = AudioQueueSetProperty(queue, kAudioQueueProperty_ChannelLayout, &layout, sizeof(layout));
+            if (status != noErr) {
+                throw audio_error{"AudioQueueSetProperty(ChannelLayout) failed: " + std::to_string(status), status};
+            }
         }
 
         static constexpr int buf_num = 3;
+        static constexpr size_t buf_frames = 1024;
         for (int i = 0; i < buf_num; i++) {
             AudioQueueBufferRef buf;
-            status = AudioQueueAllocateBuffer(queue, 4096, &buf);
+            status = AudioQueueAllocateBuffer(queue, static_cast<UInt32>(buf_frames * data.format.frame_bytes()), &buf);
             if (status != noErr) {
-            	throw std::runtime_error{"AudioQueueAllocateBuffer failed: " + std::to_string(status)};
+            	throw audio_error{"AudioQueueAllocateBuffer failed: " + std::to_string(status), status};
             }
+            buffers.push_back(buf);
             AQCallback(this, queue, buf);
         }
 
         status = AudioQueueStart(queue, nullptr);
         if (status != noErr) {
-        	throw std::runtime_error{"AudioQueueStart failed: " + std::to_string(status)};
+        	throw audio_error{"AudioQueueStart failed: " + std::to_string(status), status};
+        }
+        if (stats) {
+            stats->record_open();
         }
         return true;
     }
 	bool init(const std::string& file_path) {
-    	std::ifstream file(file_path, std::ios::binary | std::ios::ate);
-    	if (!file) {
-    		throw std::runtime_error("Failed to open file: " + file_path);
-    	}
-
-    	std::streamsize size = file.tellg();
-    	file.seekg(0, std::ios::beg);
-
-    	std::vector<char> buffer(size);
-    	if (!file.read(buffer.data(), size)) {
-    		throw std::runtime_error("Failed to read file: " + file_path);
-    	}
-
-    	return this->init(buffer);
+    	return this->init(load_wav(file_path, pcm_format{}));
     }
 	audio_manager() = default;
-	explicit audio_manager(const std::vector<char>& data) {
+	explicit audio_manager(const pcm_buffer& data) {
 		this->init(data);
 	}
 	explicit audio_manager(const std::string& file_path) {
 		this->init(file_path);
 	}
 
-    void wait_until_done() const {
-        while (offset < buffer.size()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    void wait_until_done() {
+        trace_span span("drain");
+        while (offset < buffer.frames) {
+            if (interrupted && interrupted()) {
+                if (stats) {
+                    stats->interrupts++;
+                }
+                return;
+            }
+            if (suspended && suspended()) {
+                // the queue is disposed of on the way out; the worker reopens it after resume
+                if (stats) {
+                    stats->suspends++;
+                }
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
         }
     }
 
-	void stop() const {
+    // keep-alive pulses: hold() lets the queue stop once the last buffers have played,
+    // replay() refills them from the start and starts it again
+    void hold() {
+    	AudioQueueStop(queue, false);
+    }
+
+    void replay() {
+    	offset = 0;
+    	for (auto* buf : buffers) {
+    		AQCallback(this, queue, buf);
+    	}
+
+    	const OSStatus status = AudioQueueStart(queue, nullptr);
+    	if (status != noErr) {
+    		throw audio_error{"AudioQueueStart failed: " + std::to_string(status), status};
+    	}
+    }
+
+	void stop() {
+    	if (stopped || !queue) {
+    		return;
+    	}
+    	stopped = true;
+
+    	trace_span span("close");
+
+    	if (offset < buffer.frames) {
+    		// cut short: ramp the volume down rather than stopping mid-waveform
+    		static constexpr Float32 fade_seconds = 0.01f;
+
+    		AudioQueueSetParameter(queue, kAudioQueueParam_VolumeRampTime, fade_seconds);
+    		AudioQueueSetParameter(queue, kAudioQueueParam_Volume, 0.0f);
+    		std::this_thread::sleep_for(std::chrono::duration<Float32>(fade_seconds));
+    	}
+
     	AudioQueueStop(queue, true);
     	AudioQueueDispose(queue, true);
+
+    	if (stats) {
+    		stats->record_silence();
+    	}
     }
 
     ~audio_manager() {
@@ -118,104 +212,315 @@ public:
 struct audio_manager {
     snd_pcm_t* pcm_handle = nullptr;
     snd_pcm_hw_params_t* hw_params = nullptr;
-    std::vector<char> buffer;
-    size_t offset = 0;
+    pcm_buffer buffer;
+    size_t offset = 0; // in frames
     unsigned int channels = 2;
     unsigned int rate = 44100;
     snd_pcm_uframes_t period_size = 0;
+    audio_stats* stats = nullptr;
+    std::function<bool()> interrupted;
+    std::function<bool()> suspended; // the system is about to sleep; let go of the device
+    std::function<void()> released;
+
+    static snd_pcm_format_t to_alsa(sample_format format) {
+        switch (format) {
+            case sample_format::s24_3le: return SND_PCM_FORMAT_S24_3LE;
+            case sample_format::s32: return SND_PCM_FORMAT_S32_LE;
+            case sample_format::float32: return SND_PCM_FORMAT_FLOAT_LE;
+            case sample_format::s16:
+            default: return SND_PCM_FORMAT_S16_LE;
+        }
+    }
 
-    bool init(const std::vector<char>& data, const std::string& alsa_sink = "default") {
-        buffer = data;
-        offset = 0;
+    void pause_device() {
+        trace_span span("pause");
 
-        int err;
+        if (snd_pcm_pause(pcm_handle, 1) < 0) {
+            snd_pcm_drop(pcm_handle);
+        }
+        if (stats) {
+            stats->suspends++;
+        }
+    }
+
+    // brings the stream back after a pause, a drop or a system suspend
+    void resume_device() {
+        trace_span span("resume");
+        int err = 0;
+
+        if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_SUSPENDED) {
+            while ((err = snd_pcm_resume(pcm_handle)) == -EAGAIN) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (err < 0 && (err = snd_pcm_prepare(pcm_handle)) < 0) {
+                throw audio_error{std::string{"snd_pcm_prepare failed after suspend: "} + snd_strerror(err), err};
+            }
+        }
+
+        switch (snd_pcm_state(pcm_handle)) {
+            case SND_PCM_STATE_PAUSED:
+                if (snd_pcm_pause(pcm_handle, 0) >= 0) {
+                    break;
+                }
+                snd_pcm_drop(pcm_handle);
+                [[fallthrough]];
+            case SND_PCM_STATE_SETUP:
+            case SND_PCM_STATE_XRUN:
+                if ((err = snd_pcm_prepare(pcm_handle)) < 0) {
+                    throw audio_error{std::string{"snd_pcm_prepare failed after resume: "} + snd_strerror(err), err};
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void log_resume() const {
+        if (const int64_t ns = stats->first_frame_after_resume()) {
+            std::cerr << "First frame " << ns / 1000000.0 << " ms after resume\n";
+        }
+    }
 
-        if ((err = snd_pcm_open(&pcm_handle, alsa_sink.c_str(), SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-            throw std::runtime_error{std::string{"snd_pcm_open failed: "} + snd_strerror(err)};
+    // pauses the device and lets go of it until the system has resumed; returns false,
+    // with the stream dropped, if it was interrupted in the meantime
+    bool wait_out_suspend() {
+        pause_device();
+        if (released) {
+            released();
         }
 
-        snd_pcm_hw_params_malloc(&hw_params);
-        snd_pcm_hw_params_any(pcm_handle, hw_params);
+        {
+            trace_span span("suspended");
+            while (suspended() && !(interrupted && interrupted())) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        }
+        if (interrupted && interrupted()) {
+            snd_pcm_drop(pcm_handle);
+            return false;
+        }
+
+        resume_device();
+        return true;
+    }
+
+    // takes back what has not reached the hardware yet, plays a short fade from there
+    // and drops the rest, so stopping never waits for a full buffer to drain
+    void fade_out_and_drop() {
+        static constexpr unsigned int fade_ms = 10;
+
+        trace_span span("fade out and drop");
 
-        snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-        snd_pcm_hw_params_set_format(pcm_handle, hw_params, SND_PCM_FORMAT_S16_LE);
-        snd_pcm_hw_params_set_channels(pcm_handle, hw_params, channels);
-        snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &rate, nullptr);
+        const size_t frame_size = buffer.format.frame_bytes();
+        const size_t data_frames = buffer.data_frames();
 
-        snd_pcm_hw_params_get_period_size(hw_params, &period_size, nullptr);
+        snd_pcm_sframes_t rewound = snd_pcm_rewindable(pcm_handle);
+        if (rewound > 0) {
+            rewound = snd_pcm_rewind(pcm_handle, rewound);
+        }
+        if (rewound > 0) {
+            offset -= std::min(offset, static_cast<size_t>(rewound));
+        }
+
+        // without a rewind (common with plugin sinks such as pulse, pipewire and dmix) the fade would only
+        // queue up behind everything already written, so drop right away instead
+        if (rewound > 0 && data_frames > 0) {
+            const size_t fade_frames = rate * fade_ms / 1000;
+
+            std::vector<char> tail(fade_frames * frame_size);
+            for (size_t i = 0; i < fade_frames; ++i) {
+                const size_t pos = (offset + i) % data_frames;
+                memcpy(tail.data() + i * frame_size, buffer.bytes() + pos * frame_size, frame_size);
+            }
+            apply_fade(buffer.format, tail.data(), fade_frames, fade_frames, fade::out);
 
-        if ((err = snd_pcm_hw_params(pcm_handle, hw_params)) < 0) {
-            throw std::runtime_error{"snd_pcm_hw_params failed"};
+            // what could not be rewound (often a period) plays ahead of the tail, so wait for
+            // both; dropping any earlier would cut the stream before it has faded
+            snd_pcm_sframes_t delay = 0;
+            if (snd_pcm_writei(pcm_handle, tail.data(), fade_frames) > 0 && snd_pcm_delay(pcm_handle, &delay) == 0 && delay > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(static_cast<size_t>(delay) * 1000000 / rate));
+            }
         }
 
-        snd_pcm_hw_params_free(hw_params);
-        hw_params = nullptr;
+        snd_pcm_drop(pcm_handle);
 
-        const size_t frame_size = channels * sizeof(int16_t);
-        const size_t chunk_bytes = period_size * frame_size;
+        if (stats) {
+            stats->record_silence();
+        }
+    }
 
-        while (offset < buffer.size()) {
-            size_t remaining = buffer.size() - offset;
-            size_t write_size = std::min(chunk_bytes, remaining);
-            int frames = write_size / frame_size;
+    // writes buffer from offset until all frames are queued or the stream is interrupted
+    void play() {
+        const size_t frame_size = buffer.format.frame_bytes();
+        const size_t data_frames = buffer.data_frames();
 
-            int written = snd_pcm_writei(pcm_handle, buffer.data() + offset, frames);
+        while (data_frames > 0 && offset < buffer.frames) {
+            if (interrupted && interrupted()) {
+                if (stats) {
+                    stats->interrupts++;
+                }
+                fade_out_and_drop();
+                break;
+            }
+            if (suspended && suspended()) {
+                wait_out_suspend();
+                continue;
+            }
+            const size_t pos = offset % data_frames;
+            const size_t frames = std::min({static_cast<size_t>(period_size), buffer.frames - offset, data_frames - pos});
+
+            int written;
+            {
+                trace_span span("snd_pcm_writei");
+                written = static_cast<int>(snd_pcm_writei(pcm_handle, buffer.bytes() + pos * frame_size, frames));
+                span.set_arg("result", written);
+            }
             if (written < 0) {
                 if (written == -EPIPE) {
+                    trace_span span("xrun recovery");
+                    if (stats) {
+                        stats->xruns++;
+                    }
                     snd_pcm_prepare(pcm_handle);
                     continue;
+                } else if (written == -ESTRPIPE) {
+                    // suspended underneath us without a PrepareForSleep
+                    if (stats) {
+                        stats->suspends++;
+                    }
+                    resume_device();
+                    continue;
                 } else {
-                    throw std::runtime_error{std::string{"snd_pcm_writei failed: "} + snd_strerror(written)};
+                    throw audio_error{std::string{"snd_pcm_writei failed: "} + snd_strerror(written), written};
                 }
             }
-            offset += written * frame_size;
+            offset += written;
+            if (stats) {
+                stats->writes++;
+                stats->frames_written += written;
+                log_resume();
+            }
         }
+    }
 
-	/*
-        std::vector<char> silence(chunk_bytes, 0);
-        for (int i = 0; i < 4; ++i) {
-            snd_pcm_writei(pcm_handle, silence.data(), period_size);
-        }
-	*/
+    bool init(const pcm_buffer& data, const std::string& alsa_sink = "default") {
+        buffer = data;
+        offset = 0;
+        channels = data.format.channels();
+        rate = data.format.rate;
 
-        return true;
-    }
+        int err;
 
-    bool init(const std::string& file_path, const std::string& sink = "default") {
-        std::ifstream file(file_path, std::ios::binary | std::ios::ate);
-        if (!file) {
-            throw std::runtime_error("Failed to open file: " + file_path);
+        {
+            trace_span span("snd_pcm_open");
+            if ((err = snd_pcm_open(&pcm_handle, alsa_sink.c_str(), SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+                throw audio_error{std::string{"snd_pcm_open failed: "} + snd_strerror(err), err};
+            }
         }
 
-        std::streamsize size = file.tellg();
-        file.seekg(0, std::ios::beg);
+        {
+            trace_span span("hw_params");
 
-        std::vector<char> buffer(size);
-        if (!file.read(buffer.data(), size)) {
-            throw std::runtime_error("Failed to read file: " + file_path);
+            snd_pcm_hw_params_malloc(&hw_params);
+            snd_pcm_hw_params_any(pcm_handle, hw_params);
+
+            snd_pcm_hw_params_set_access(pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+            if ((err = snd_pcm_hw_params_set_format(pcm_handle, hw_params, to_alsa(data.format.format))) < 0) {
+                throw audio_error{"Sample format " + to_string(data.format.format) + " not supported: " + snd_strerror(err), err};
+            }
+            if ((err = snd_pcm_hw_params_set_channels(pcm_handle, hw_params, channels)) < 0) {
+                throw audio_error{"Channel layout " + to_string(data.format.layout) + " not supported: " + snd_strerror(err), err};
+            }
+            snd_pcm_hw_params_set_rate_near(pcm_handle, hw_params, &rate, nullptr);
+
+            if ((err = snd_pcm_hw_params(pcm_handle, hw_params)) < 0) {
+                throw audio_error{std::string{"snd_pcm_hw_params failed: "} + snd_strerror(err), err};
+            }
+
+            snd_pcm_hw_params_get_period_size(hw_params, &period_size, nullptr);
+            if (period_size == 0) {
+                period_size = 1024;
+            }
+
+            snd_pcm_hw_params_free(hw_params);
+            hw_params = nullptr;
         }
 
-        return this->init(buffer, sink);
+        if (stats) {
+            stats->record_open();
+        }
+
+        play();
+
+        return true;
+    }
+
+    bool init(const std::string& file_path, const std::string& sink = "default") {
+        return this->init(load_wav(file_path, pcm_format{}), sink);
     }
 
     audio_manager() = default;
-    audio_manager(const std::vector<char>& data) { this->init(data); }
+    audio_manager(const pcm_buffer& data) { this->init(data); }
     audio_manager(const std::string& file_path) { this->init(file_path); }
 
-    void wait_until_done() const {
+    void wait_until_done() {
+        trace_span span("drain");
         snd_pcm_sframes_t delay = 0;
         while (true) {
             if (snd_pcm_delay(pcm_handle, &delay) < 0) break;
             if (delay <= 0) break;
+            if (interrupted && interrupted()) {
+                fade_out_and_drop();
+                break;
+            }
+            // a sleep must not wait for a large buffer to play out before the device is let go
+            if (suspended && suspended()) {
+                if (!wait_out_suspend()) {
+                    break;
+                }
+                continue;
+            }
             std::this_thread::sleep_for(std::chrono::milliseconds(20));
         }
     }
 
+    // keep-alive pulses: hold() stops the drained stream but keeps the device open,
+    // replay() plays the same buffer again from the start
+    void hold() {
+        snd_pcm_drop(pcm_handle);
+    }
+
+    void replay() {
+        int err;
+        {
+            trace_span span("snd_pcm_prepare");
+            if ((err = snd_pcm_prepare(pcm_handle)) < 0) {
+                throw audio_error{std::string{"snd_pcm_prepare failed: "} + snd_strerror(err), err};
+            }
+        }
+
+        offset = 0;
+        play();
+    }
+
     void stop() {
+        if (hw_params) {
+            snd_pcm_hw_params_free(hw_params);
+            hw_params = nullptr;
+        }
         if (pcm_handle) {
-            snd_pcm_drain(pcm_handle);
+            trace_span span("close");
+
+            // wait_until_done() has played everything out or we are bailing; either way
+            // there is nothing worth draining
+            snd_pcm_drop(pcm_handle);
             snd_pcm_close(pcm_handle);
             pcm_handle = nullptr;
+
+            // toggled off between pulses, with nothing playing to fade
+            if (stats) {
+                stats->record_silence();
+            }
         }
     }
 
@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+inline int64_t steady_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+/*
+ * Counters describing what the audio path has done since launch.
+ * Written by the worker thread, read by anyone (D-Bus, reports).
+ */
+struct audio_stats {
+	std::atomic<uint64_t> loops{0};          // completed playback iterations
+	std::atomic<uint64_t> opens{0};          // device opens
+	std::atomic<uint64_t> writes{0};         // period writes handed to the device
+	std::atomic<uint64_t> frames_written{0}; // frames accepted by the device
+	std::atomic<uint64_t> xruns{0};          // underruns recovered from
+	std::atomic<uint64_t> interrupts{0};     // streams cut short by a settings change
+	std::atomic<uint64_t> errors{0};         // iterations that ended in an exception
+	std::atomic<uint64_t> fatal_errors{0};   // errors that disabled playback
+	std::atomic<uint64_t> retries{0};        // reopens scheduled after a transient error
+
+	// time and attempts from the first transient error until the device takes frames again
+	std::atomic<uint64_t> recoveries{0};
+	std::atomic<uint64_t> recovery_ns_total{0};
+	std::atomic<uint64_t> recovery_ns_max{0};
+	std::atomic<uint64_t> recovery_attempts_max{0};
+
+	// time from the end of one iteration until the next one has the device open
+	std::atomic<int64_t>  last_open_ns{0};
+	std::atomic<uint64_t> boundaries{0};
+	std::atomic<uint64_t> boundary_ns_total{0};
+	std::atomic<uint64_t> boundary_ns_max{0};
+
+	// time from a system resume until the first frame is written again
+	std::atomic<int64_t>  resume_requested_ns{0}; // nonzero while a resume is pending
+	std::atomic<uint64_t> suspends{0};
+	std::atomic<uint64_t> resumes{0};
+	std::atomic<uint64_t> resume_ns_last{0};
+	std::atomic<uint64_t> resume_ns_max{0};
+
+	// time from toggling off until the device has gone quiet
+	std::atomic<int64_t>  silence_requested_ns{0}; // nonzero while a toggle-off is pending
+	std::atomic<uint64_t> silences{0};
+	std::atomic<uint64_t> silence_ns_last{0};
+	std::atomic<uint64_t> silence_ns_max{0};
+
+	// keep-alive pulse mode; duty cycle is active / (active + idle)
+	std::atomic<uint64_t> pulses{0};
+	std::atomic<uint64_t> pulse_active_ns{0}; // from the start of a burst until it has played
+	std::atomic<uint64_t> pulse_idle_ns{0};   // device held open with nothing playing
+
+	// processed custom audio cache; hit rate is hits / (hits + misses)
+	std::atomic<uint64_t> cache_hits{0};
+	std::atomic<uint64_t> cache_misses{0};
+	std::atomic<uint64_t> cache_evictions{0};
+
+	void record_open() {
+		opens++;
+		last_open_ns = steady_ns();
+	}
+
+	// called after every write; returns the resume-to-first-frame time if a resume was pending
+	int64_t first_frame_after_resume() {
+		if (resume_requested_ns.load(std::memory_order_relaxed) == 0) {
+			return 0;
+		}
+
+		const int64_t requested = resume_requested_ns.exchange(0);
+		if (requested == 0) {
+			return 0;
+		}
+
+		const int64_t ns = std::max<int64_t>(steady_ns() - requested, 1);
+		resumes++;
+		resume_ns_last = static_cast<uint64_t>(ns);
+
+		uint64_t max = resume_ns_max.load();
+		while (static_cast<uint64_t>(ns) > max && !resume_ns_max.compare_exchange_weak(max, ns)) {
+		}
+
+		return ns;
+	}
+
+	void record_recovery(uint64_t ns, uint64_t attempts) {
+		recoveries++;
+		recovery_ns_total += ns;
+
+		uint64_t max = recovery_ns_max.load();
+		while (ns > max && !recovery_ns_max.compare_exchange_weak(max, ns)) {
+		}
+		max = recovery_attempts_max.load();
+		while (attempts > max && !recovery_attempts_max.compare_exchange_weak(max, attempts)) {
+		}
+	}
+
+	void record_silence() {
+		const int64_t requested = silence_requested_ns.exchange(0);
+		if (requested == 0) {
+			return;
+		}
+
+		const auto ns   = static_cast<uint64_t>(std::max<int64_t>(steady_ns() - requested, 0));
+		silences++;
+		silence_ns_last = ns;
+
+		uint64_t max = silence_ns_max.load();
+		while (ns > max && !silence_ns_max.compare_exchange_weak(max, ns)) {
+		}
+	}
+
+	void record_boundary(uint64_t ns) {
+		boundaries++;
+		boundary_ns_total += ns;
+
+		uint64_t max = boundary_ns_max.load();
+		while (ns > max && !boundary_ns_max.compare_exchange_weak(max, ns)) {
+		}
+	}
+};
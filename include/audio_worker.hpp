@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <audio_cache.hpp>
+#include <audio_stats.hpp>
+#include <pcm_format.hpp>
+#include <supervisor.hpp>
+
+/*
+ * Keep-alive pulses instead of a continuous stream: the device is held open
+ * and a short burst is played every interval seconds, with the audio thread
+ * blocked in between.
+ */
+struct pulse_settings {
+	int  interval = 0;   // seconds from one burst to the next; 0 streams continuously
+	int  burst    = 500; // milliseconds
+	bool dither   = false;
+
+	bool operator==(const pulse_settings& other) const {
+		return interval == other.interval && burst == other.burst && dither == other.dither;
+	}
+	bool operator!=(const pulse_settings& other) const { return !(*this == other); }
+};
+
+/*
+ * Owns the playback loop and the settings it plays with. Setters may be
+ * called from any thread; a change of sink, file, format or length cuts the
+ * current stream short so the next iteration picks it up immediately.
+ */
+class audio_worker {
+public:
+	void set_enabled(bool enabled);
+	bool enabled() const;
+
+	void set_length(int seconds);
+	int length() const;
+
+	void set_sink(const std::string& sink);
+	std::string sink() const;
+
+	void set_audio_file(const std::string& file);
+	std::string audio_file() const;
+
+	void       set_format(const pcm_format& format);
+	pcm_format format() const;
+
+	void           set_pulse(const pulse_settings& pulse);
+	pulse_settings pulse() const;
+
+	// system sleep: suspend() makes the audio thread pause or drop the device,
+	// wait_released() blocks until it has, resume() lets it continue
+	void suspend();
+	bool wait_released(std::chrono::milliseconds timeout);
+	void resume();
+
+	const audio_stats& stats() const { return counters; }
+
+	// called from the worker thread; fatal errors have already disabled playback,
+	// transient ones are reported once they have failed backoff_policy::report_after times
+	std::function<void(const std::string&, bool fatal)> error_handler;
+
+	backoff_policy retry_policy{};
+
+	// size limit of the on-disk cache of processed custom audio, read when run() starts
+	uintmax_t cache_limit = audio_cache::default_limit;
+
+	void run();
+	void request_quit();
+
+private:
+	bool interrupted(uint64_t started) const;
+	void wait_interruptible(std::chrono::steady_clock::duration delay, uint64_t started);
+	void wake();
+	void mark_released();
+
+	mutable std::mutex mutex;
+	std::string sink_name{"default"};
+	std::string file_name{};
+	pcm_format  stream_format{};
+	pulse_settings pulse_mode{};
+
+	std::atomic<bool>     state{false};
+	std::atomic<int>      len{500};
+	std::atomic<uint64_t> generation{0};
+	std::atomic<bool>     quit{false};
+	std::atomic<bool>     suspended{false};
+	std::atomic<bool>     release_pending{false}; // suspend() not yet acknowledged by the audio thread
+
+	// the audio thread blocks on wake_cv while idle; every setter notifies it
+	std::mutex              wake_mutex;
+	std::condition_variable wake_cv;
+
+	std::mutex              release_mutex;
+	std::condition_variable release_cv;
+	bool                    released = false;
+
+	audio_stats counters;
+};
@@ -7,6 +7,10 @@
 #include <QCheckBox>
 #include <QPushButton>
 #include <QLabel>
+#include <QComboBox>
+
+#include <audio_worker.hpp>
+#include <pcm_format.hpp>
 
 class config_dialog : public QDialog {
 	Q_OBJECT
@@ -18,6 +22,8 @@ public:
 		bool,
 #endif
 		std::string,
+		const pcm_format&,
+		const pulse_settings&,
 #ifdef LINUX
 		std::string,
 #endif
@@ -25,6 +31,8 @@ public:
 
 	int audio_length() const;
 	std::string custom_audio_file() const;
+	pcm_format stream_format() const;
+	pulse_settings pulse() const;
 #ifdef LINUX
 	std::string get_alsa_sink() const;
 #endif
@@ -42,4 +50,10 @@ private:
 	QLabel* alsa_sink_label;
 	QLineEdit* alsa_sink;
 	QPushButton* browse_button;
+	QComboBox* layout_box;
+	QComboBox* format_box;
+	QComboBox* rate_box;
+	QSpinBox* pulse_box;
+	QCheckBox* dither_box;
+	int pulse_burst;
 };
@@ -0,0 +1,43 @@
+#pragma once
+#include <QDBusContext>
+#include <QObject>
+#include <QString>
+#include <QVariantMap>
+
+#include <audio_worker.hpp>
+
+/*
+ * Session bus control interface, exported as com.jacobnilsson.tystnad on
+ * object path /. Every call is applied to the running worker directly.
+ */
+class dbus_interface : public QObject, protected QDBusContext {
+	Q_OBJECT
+	Q_CLASSINFO("D-Bus Interface", "com.jacobnilsson.tystnad")
+public:
+	static constexpr const char* service = "com.jacobnilsson.tystnad";
+	static constexpr const char* path    = "/";
+
+	explicit dbus_interface(audio_worker& worker, QObject* parent = nullptr);
+	bool register_service();
+
+public slots:
+	Q_SCRIPTABLE bool Toggle();
+	Q_SCRIPTABLE void SetEnabled(bool enabled);
+	Q_SCRIPTABLE void SetLength(int seconds);
+	Q_SCRIPTABLE void SetSink(const QString& sink);
+	Q_SCRIPTABLE void SetAudioFile(const QString& file);
+	Q_SCRIPTABLE void SetStreamFormat(const QString& format, const QString& layout, uint rate);
+	Q_SCRIPTABLE void SetPulse(int interval, int burst, bool dither);
+	Q_SCRIPTABLE void SetTracing(bool enabled);
+	Q_SCRIPTABLE void DumpTrace(const QString& path);
+	Q_SCRIPTABLE QVariantMap Status() const;
+	Q_SCRIPTABLE QVariantMap Counters() const;
+
+signals:
+	void enabled_changed(bool enabled);
+	void settings_changed();
+
+private:
+	audio_worker& worker;
+	int64_t       started_ns; // for average CPU in Counters()
+};
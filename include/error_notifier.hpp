@@ -0,0 +1,13 @@
+#pragma once
+#include <QObject>
+#include <QString>
+
+/*
+ * Carries worker errors to the GUI thread. error() is emitted from the
+ * worker thread and must be connected with Qt::QueuedConnection.
+ */
+class error_notifier : public QObject {
+	Q_OBJECT
+signals:
+	void error(const QString& message, bool fatal);
+};
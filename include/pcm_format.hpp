@@ -0,0 +1,221 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+enum class sample_format {
+	s16,
+	s24_3le,
+	s32,
+	float32,
+};
+
+enum class channel_layout {
+	stereo,      // 2.0
+	surround_51, // 5.1
+	surround_71, // 7.1
+};
+
+enum class fade {
+	in,
+	out,
+};
+
+/*
+ * Device stream format. Samples are always little endian and interleaved,
+ * channels in WAV order (FL FR FC LFE BL BR SL SR).
+ */
+struct pcm_format {
+	unsigned int   rate   = 44100;
+	sample_format  format = sample_format::s16;
+	channel_layout layout = channel_layout::stereo;
+
+	unsigned int channels() const;
+	size_t       sample_bytes() const;
+	size_t       frame_bytes() const { return sample_bytes() * channels(); }
+
+	bool operator==(const pcm_format& other) const {
+		return rate == other.rate && format == other.format && layout == other.layout;
+	}
+	bool operator!=(const pcm_format& other) const { return !(*this == other); }
+};
+
+/*
+ * Interleaved frames to play. When frames is larger than the data holds,
+ * the data is repeated until frames have been played, which lets long
+ * stretches of silence be played from a single small buffer.
+ *
+ * The frames are either owned in data or, when mapped is set, live in
+ * shared read-only memory such as a mapped cache file.
+ */
+struct pcm_buffer {
+	pcm_format                  format{};
+	std::vector<char>           data;
+	size_t                      frames = 0;
+	std::shared_ptr<const char> mapped;
+	size_t                      mapped_bytes = 0;
+
+	const char* bytes() const { return mapped ? mapped.get() : data.data(); }
+	size_t      byte_size() const { return mapped ? mapped_bytes : data.size(); }
+	size_t      data_frames() const { return byte_size() / format.frame_bytes(); }
+};
+
+std::string    to_string(sample_format format);
+std::string    to_string(channel_layout layout);
+sample_format  sample_format_from_string(const std::string& str);
+channel_layout channel_layout_from_string(const std::string& str);
+unsigned int   channel_count(channel_layout layout);
+
+// runtime entry points for the kernels below
+void apply_fade(const pcm_format& format, char* data, size_t frames, size_t fade_length, fade direction);
+void fill_dither(const pcm_format& format, char* data, size_t frames, float amplitude);
+
+template <sample_format F>
+struct sample_traits;
+
+template <>
+struct sample_traits<sample_format::s16> {
+	static constexpr size_t bytes = 2;
+
+	static float read(const char* p) {
+		int16_t v;
+		std::memcpy(&v, p, bytes);
+		return static_cast<float>(v) / 32768.f;
+	}
+	static void write(char* p, float v) {
+		auto s = static_cast<int16_t>(std::clamp(v, -1.f, 1.f) * 32767.f);
+		std::memcpy(p, &s, bytes);
+	}
+};
+
+template <>
+struct sample_traits<sample_format::s24_3le> {
+	static constexpr size_t bytes = 3;
+
+	static float read(const char* p) {
+		const auto* u = reinterpret_cast<const uint8_t*>(p);
+		uint32_t    v = static_cast<uint32_t>(u[0]) << 8 | static_cast<uint32_t>(u[1]) << 16 |
+					 static_cast<uint32_t>(u[2]) << 24;
+		return static_cast<float>(static_cast<int32_t>(v) >> 8) / 8388608.f;
+	}
+	static void write(char* p, float v) {
+		auto s = static_cast<int32_t>(std::clamp(v, -1.f, 1.f) * 8388607.f);
+		p[0]   = static_cast<char>(s & 0xFF);
+		p[1]   = static_cast<char>((s >> 8) & 0xFF);
+		p[2]   = static_cast<char>((s >> 16) & 0xFF);
+	}
+};
+
+template <>
+struct sample_traits<sample_format::s32> {
+	static constexpr size_t bytes = 4;
+
+	static float read(const char* p) {
+		int32_t v;
+		std::memcpy(&v, p, bytes);
+		return static_cast<float>(v) / 2147483648.f;
+	}
+	static void write(char* p, float v) {
+		// 2147483647.f rounds up to 2^31, so clamp in double
+		auto s = static_cast<int32_t>(std::clamp(static_cast<double>(v), -1.0, 1.0) * 2147483647.0);
+		std::memcpy(p, &s, bytes);
+	}
+};
+
+template <>
+struct sample_traits<sample_format::float32> {
+	static constexpr size_t bytes = 4;
+
+	static float read(const char* p) {
+		float v;
+		std::memcpy(&v, p, bytes);
+		return v;
+	}
+	static void write(char* p, float v) { std::memcpy(p, &v, bytes); }
+};
+
+/*
+ * Fade kernels. Format and channel count are template parameters so the
+ * per-sample loops have no format or layout branches.
+ */
+template <sample_format F, unsigned int C, fade D>
+void fade_frames(char* data, size_t frames, size_t fade_length) {
+	using traits = sample_traits<F>;
+
+	const size_t n     = std::min(frames, fade_length);
+	const size_t first = D == fade::in ? 0 : frames - n;
+	const float  step  = n ? 1.f / static_cast<float>(n) : 0.f;
+
+	for (size_t i = 0; i < n; ++i) {
+		const float gain = D == fade::in ? static_cast<float>(i) * step : static_cast<float>(n - 1 - i) * step;
+		char*       p    = data + (first + i) * C * traits::bytes;
+
+		for (unsigned int ch = 0; ch < C; ++ch) {
+			traits::write(p + ch * traits::bytes, traits::read(p + ch * traits::bytes) * gain);
+		}
+	}
+}
+
+/*
+ * Triangular noise of at most +-amplitude from a fixed xorshift seed, so
+ * the same burst is generated every time.
+ */
+template <sample_format F, unsigned int C>
+void dither_frames(char* data, size_t frames, float amplitude) {
+	using traits = sample_traits<F>;
+
+	uint32_t state   = 0x9E3779B9u;
+	auto     uniform = [&state]() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return static_cast<float>(state) / 4294967296.f;
+	};
+
+	for (size_t frame = 0; frame < frames; ++frame) {
+		for (unsigned int ch = 0; ch < C; ++ch) {
+			traits::write(data + (frame * C + ch) * traits::bytes, (uniform() - uniform()) * amplitude);
+		}
+	}
+}
+
+/*
+ * Calls fn(std::integral_constant<sample_format, F>, std::integral_constant<unsigned int, C>)
+ * for the format and channel count of a stream format.
+ */
+template <typename Fn>
+void dispatch_format(const pcm_format& format, Fn&& fn) {
+	auto with_format = [&](auto f) {
+		switch (format.layout) {
+		case channel_layout::stereo:
+			fn(f, std::integral_constant<unsigned int, 2>{});
+			break;
+		case channel_layout::surround_51:
+			fn(f, std::integral_constant<unsigned int, 6>{});
+			break;
+		case channel_layout::surround_71:
+			fn(f, std::integral_constant<unsigned int, 8>{});
+			break;
+		}
+	};
+
+	switch (format.format) {
+	case sample_format::s16:
+		with_format(std::integral_constant<sample_format, sample_format::s16>{});
+		break;
+	case sample_format::s24_3le:
+		with_format(std::integral_constant<sample_format, sample_format::s24_3le>{});
+		break;
+	case sample_format::s32:
+		with_format(std::integral_constant<sample_format, sample_format::s32>{});
+		break;
+	case sample_format::float32:
+		with_format(std::integral_constant<sample_format, sample_format::float32>{});
+		break;
+	}
+}
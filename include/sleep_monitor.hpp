@@ -0,0 +1,34 @@
+#pragma once
+#include <QDBusConnection>
+#include <QDBusUnixFileDescriptor>
+#include <QObject>
+#include <QString>
+
+#include <audio_worker.hpp>
+
+/*
+ * Listens for logind's PrepareForSleep and suspends the worker around
+ * system sleep. A delay inhibitor is held while awake so the device can be
+ * let go of before the system actually sleeps.
+ *
+ * TYSTNAD_LOGIND_BUS=session and TYSTNAD_LOGIND_SERVICE point it at a
+ * stand-in service instead of the real logind; an empty service accepts the
+ * signal from any sender.
+ */
+class sleep_monitor : public QObject {
+	Q_OBJECT
+public:
+	explicit sleep_monitor(audio_worker& worker, QObject* parent = nullptr);
+	bool start();
+
+private slots:
+	void prepare_for_sleep(bool sleeping);
+
+private:
+	void take_inhibitor();
+
+	audio_worker&           worker;
+	QDBusConnection         bus;
+	QString                 service;
+	QDBusUnixFileDescriptor inhibitor;
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <audio_worker.hpp>
+
+/*
+ * Headless soak test: runs the worker loop for a fixed duration, samples
+ * CPU time, context switches, RSS and audio counters, and writes a report.
+ * Entered with --soak <seconds>; see --help for the other options.
+ */
+bool is_soak_run(int argc, char* argv[]);
+int  soak_main(int argc, char* argv[], audio_worker& worker);
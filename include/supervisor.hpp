@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <exception>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+/*
+ * Error thrown by the audio backends. code is a negative errno on Linux and
+ * an OSStatus on macOS, and decides whether the worker retries.
+ */
+struct audio_error : std::runtime_error {
+	int code;
+
+	audio_error(const std::string& what, int code) : std::runtime_error(what), code(code) {}
+};
+
+enum class error_class {
+	transient, // the device is busy or gone for now; reopen later
+	fatal,     // retrying will not help; report and stop
+};
+
+error_class classify(const std::exception& e);
+
+struct backoff_policy {
+	std::chrono::milliseconds initial{250};
+	std::chrono::milliseconds max{30000};
+	double                    multiplier   = 2.0;
+	double                    jitter       = 0.5; // fraction of each delay that is randomized
+	unsigned int              report_after = 5;   // consecutive failures before telling the user
+};
+
+/*
+ * Jittered exponential backoff. Every call to next() returns the delay to
+ * wait before the next attempt; reset() once an attempt succeeds.
+ */
+class backoff {
+public:
+	explicit backoff(const backoff_policy& policy = {});
+
+	std::chrono::milliseconds next();
+	void                      reset() { failures = 0; }
+	unsigned int              attempts() const { return failures; }
+	const backoff_policy&     policy() const { return settings; }
+
+private:
+	backoff_policy   settings;
+	unsigned int     failures = 0;
+	std::minstd_rand rng;
+};
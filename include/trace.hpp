@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <audio_stats.hpp>
+
+/*
+ * Opt-in span tracing of the audio path, written out as Chrome trace JSON
+ * (chrome://tracing, ui.perfetto.dev). Every thread records into its own
+ * fixed-size ring, so recording takes no locks and only the newest events
+ * per thread are kept. While tracing is off a span costs one relaxed load.
+ */
+inline std::atomic<bool> trace_active{false};
+
+// events_per_thread is rounded up to a power of two; rings are allocated when a thread first records
+void trace_enable(size_t events_per_thread = 65536);
+void trace_disable();
+void trace_thread_name(const std::string& name);
+bool trace_dump(const std::string& path);
+
+void trace_record(const char* name, int64_t start_ns, int64_t end_ns, const char* arg_name, int64_t arg);
+
+/*
+ * Records the time from construction to destruction as one complete event.
+ * name and arg_name must be string literals; they are stored as pointers.
+ */
+class trace_span {
+public:
+	explicit trace_span(const char* name)
+		: name(name), start_ns(trace_active.load(std::memory_order_relaxed) ? steady_ns() : 0) {}
+
+	~trace_span() {
+		if (start_ns != 0) {
+			trace_record(name, start_ns, steady_ns(), arg_name, arg);
+		}
+	}
+
+	trace_span(const trace_span&)            = delete;
+	trace_span& operator=(const trace_span&) = delete;
+
+	void set_arg(const char* key, int64_t value) {
+		arg_name = key;
+		arg      = value;
+	}
+
+private:
+	const char* name;
+	int64_t     start_ns;
+	const char* arg_name = nullptr;
+	int64_t     arg      = 0;
+};
@@ -1,7 +1,18 @@
 #pragma once
-
+#include <string>
 #include <vector>
 
-void apply_fade_in(std::vector<char>& buffer, int in_samples, int channels);
-std::vector<char> generate_empty_sound(int duration_seconds, int sample_rate = 44100,
-	int num_channels = 2, int bits_per_sample = 16);
\ No newline at end of file
+#include <pcm_format.hpp>
+
+void apply_fade_in(pcm_buffer& buffer, size_t in_frames);
+pcm_buffer generate_empty_sound(int duration_seconds, const pcm_format& format = {});
+// a keep-alive burst: silence, or low-level dither for receivers that treat digital silence as no signal
+pcm_buffer generate_burst(int duration_ms, bool dither, const pcm_format& format = {});
+
+/*
+ * Converts a WAV file to the sample format and channel layout of target,
+ * keeping its sample rate. Data without a RIFF header is taken to already
+ * be raw PCM in the target format.
+ */
+pcm_buffer read_wav(const std::vector<char>& bytes, const pcm_format& target);
+pcm_buffer load_wav(const std::string& file_path, const pcm_format& target);
@@ -0,0 +1,293 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include <audio_cache.hpp>
+#include <wav.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+// bump when decoding or conversion changes what ends up in an entry
+constexpr char magic[8] = {'t', 'y', 's', 't', 'p', 'c', 'm', '1'};
+
+struct entry_header {
+	char     magic[8];
+	uint32_t key_bytes;
+	uint32_t rate;
+	uint8_t  format;
+	uint8_t  layout;
+	uint8_t  reserved[6];
+	uint64_t frames;
+	uint64_t data_bytes;
+};
+
+size_t data_offset(uint32_t key_bytes) {
+	static constexpr size_t alignment = 16;
+	return (sizeof(entry_header) + key_bytes + alignment - 1) / alignment * alignment;
+}
+
+std::string hex_hash(const std::string& key) {
+	// FNV-1a; the full key is stored in the entry and compared on load
+	uint64_t hash = 0xcbf29ce484222325;
+	for (unsigned char c : key) {
+		hash = (hash ^ c) * 0x100000001b3;
+	}
+
+	static constexpr char digits[] = "0123456789abcdef";
+
+	std::string out(16, '0');
+	for (int i = 15; i >= 0; --i, hash >>= 4) {
+		out[static_cast<size_t>(i)] = digits[hash & 0xF];
+	}
+	return out;
+}
+
+bool valid_format(uint8_t format, uint8_t layout) {
+	return format <= static_cast<uint8_t>(sample_format::float32) &&
+		   layout <= static_cast<uint8_t>(channel_layout::surround_71);
+}
+} // namespace
+
+audio_cache::audio_cache(fs::path directory, uintmax_t limit, audio_stats* stats)
+	: stats(stats), directory(std::move(directory)), limit(limit) {
+	// a lowered limit applies from launch rather than from the next miss
+	if (!this->directory.empty()) {
+		evict({});
+	}
+}
+
+fs::path audio_cache::default_directory() {
+	const char* home = std::getenv("HOME");
+#if MACOS
+	return home ? fs::path(home) / "Library" / "Caches" / "tystnad" : fs::path();
+#else
+	if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+		return fs::path(xdg) / "tystnad";
+	}
+	return home ? fs::path(home) / ".cache" / "tystnad" : fs::path();
+#endif
+}
+
+pcm_buffer audio_cache::load(const std::string& file_path, const pcm_format& target, std::chrono::milliseconds fade_in) {
+	auto decode = [&]() {
+		pcm_buffer buffer = load_wav(file_path, target);
+		apply_fade_in(buffer, buffer.format.rate * static_cast<size_t>(fade_in.count()) / 1000);
+		return buffer;
+	};
+
+	std::error_code ec;
+	const fs::path  source = fs::canonical(file_path, ec);
+	const uintmax_t size   = ec ? 0 : fs::file_size(source, ec);
+	const auto      mtime  = ec ? fs::file_time_type{} : fs::last_write_time(source, ec);
+
+	if (ec || directory.empty()) {
+		if (stats) {
+			stats->cache_misses++;
+		}
+		return decode();
+	}
+
+	const std::string key = source.string() + "\n" + std::to_string(mtime.time_since_epoch().count()) + "\n" +
+							std::to_string(size) + "\n" + to_string(target.format) + " " + to_string(target.layout) +
+							" " + std::to_string(target.rate) + "\n" + std::to_string(fade_in.count()) + "\n";
+
+	// the same file on every loop; only the stat above is repeated
+	if (key == last_key) {
+		if (stats) {
+			stats->cache_hits++;
+		}
+		return last;
+	}
+
+	const fs::path entry  = directory / (hex_hash(key) + ".pcm");
+	pcm_buffer     buffer = map_entry(entry, key);
+
+	if (buffer.mapped) {
+		if (stats) {
+			stats->cache_hits++;
+		}
+		fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+	} else {
+		if (stats) {
+			stats->cache_misses++;
+		}
+		buffer = decode();
+		if (buffer.byte_size() <= limit) {
+			store(entry, key, buffer);
+			evict(entry);
+
+			// later loops share the mapping instead of copying the decoded data around
+			if (pcm_buffer mapped = map_entry(entry, key); mapped.mapped) {
+				buffer = std::move(mapped);
+			}
+		}
+	}
+
+	// not cached (too large or nowhere to write): share the decoded frames so that
+	// handing them out on later loops copies nothing
+	if (!buffer.mapped) {
+		auto owned          = std::make_shared<const std::vector<char>>(std::move(buffer.data));
+		buffer.mapped       = std::shared_ptr<const char>(owned, owned->data());
+		buffer.mapped_bytes = owned->size();
+		buffer.data.clear();
+	}
+
+	last_key = key;
+	last     = buffer;
+	return buffer;
+}
+
+pcm_buffer audio_cache::map_entry(const fs::path& entry, const std::string& key) const {
+	const int fd = open(entry.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return {};
+	}
+
+	struct stat st {};
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(entry_header)) {
+		close(fd);
+		return {};
+	}
+
+	const auto size = static_cast<size_t>(st.st_size);
+	void*      base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return {};
+	}
+
+	std::shared_ptr<const char> owner(static_cast<const char*>(base), [size](const char* p) {
+		munmap(const_cast<char*>(p), size);
+	});
+
+	entry_header header{};
+	std::memcpy(&header, owner.get(), sizeof(header));
+
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.key_bytes != key.size() ||
+		data_offset(header.key_bytes) + header.data_bytes > size || !valid_format(header.format, header.layout) ||
+		key.compare(0, key.size(), owner.get() + sizeof(header), header.key_bytes) != 0) {
+		return {};
+	}
+
+	pcm_buffer buffer;
+	buffer.format.rate   = header.rate;
+	buffer.format.format = static_cast<sample_format>(header.format);
+	buffer.format.layout = static_cast<channel_layout>(header.layout);
+	buffer.frames        = header.frames;
+
+	if (header.data_bytes % buffer.format.frame_bytes() != 0) {
+		return {};
+	}
+
+	buffer.mapped       = std::shared_ptr<const char>(owner, owner.get() + data_offset(header.key_bytes));
+	buffer.mapped_bytes = header.data_bytes;
+	return buffer;
+}
+
+void audio_cache::store(const fs::path& entry, const std::string& key, const pcm_buffer& buffer) const {
+	std::error_code ec;
+	fs::create_directories(directory, ec);
+	if (ec) {
+		std::cerr << "Failed to create cache directory " << directory << ": " << ec.message() << "\n";
+		return;
+	}
+
+	entry_header header{};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.key_bytes  = static_cast<uint32_t>(key.size());
+	header.rate       = buffer.format.rate;
+	header.format     = static_cast<uint8_t>(buffer.format.format);
+	header.layout     = static_cast<uint8_t>(buffer.format.layout);
+	header.frames     = buffer.frames;
+	header.data_bytes = buffer.byte_size();
+
+	// written aside and renamed into place so a reader never maps half an entry
+	fs::path temp = entry;
+	temp += ".tmp" + std::to_string(getpid());
+
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		const std::vector<char> padding(data_offset(header.key_bytes) - sizeof(header) - key.size(), 0);
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(key.data(), static_cast<std::streamsize>(key.size()));
+		out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+		out.write(buffer.bytes(), static_cast<std::streamsize>(buffer.byte_size()));
+
+		if (!out) {
+			std::cerr << "Failed to write cache entry " << temp << "\n";
+			out.close();
+			fs::remove(temp, ec);
+			return;
+		}
+	}
+
+	fs::rename(temp, entry, ec);
+	if (ec) {
+		std::cerr << "Failed to write cache entry " << entry << ": " << ec.message() << "\n";
+		fs::remove(temp, ec);
+	}
+}
+
+void audio_cache::evict(const fs::path& keep) const {
+	struct cached_file {
+		fs::path           path;
+		uintmax_t          size;
+		fs::file_time_type used;
+	};
+
+	std::vector<cached_file> files;
+	uintmax_t                total = 0;
+
+	// a temp file this old was left behind by a write that never finished
+	const auto stale = fs::file_time_type::clock::now() - std::chrono::minutes(10);
+
+	std::error_code ec;
+	for (const auto& it : fs::directory_iterator(directory, ec)) {
+		const std::string extension = it.path().extension().string();
+		const bool        temp      = extension.rfind(".tmp", 0) == 0;
+		if ((extension != ".pcm" && !temp) || !it.is_regular_file(ec)) {
+			continue;
+		}
+
+		cached_file file{it.path(), it.file_size(ec), it.last_write_time(ec)};
+		if (ec) {
+			continue;
+		}
+		if (temp && file.used < stale && fs::remove(file.path, ec)) {
+			continue;
+		}
+
+		// a write still in progress counts towards the limit but is never a candidate
+		total += file.size;
+		if (!temp) {
+			files.push_back(std::move(file));
+		}
+	}
+
+	std::sort(files.begin(), files.end(), [](const cached_file& a, const cached_file& b) { return a.used < b.used; });
+
+	for (const auto& file : files) {
+		if (total <= limit) {
+			break;
+		}
+		if (file.path == keep || !fs::remove(file.path, ec)) {
+			continue;
+		}
+
+		total -= file.size;
+		if (stats) {
+			stats->cache_evictions++;
+		}
+	}
+}
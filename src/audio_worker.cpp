@@ -0,0 +1,349 @@
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <audio_manager.hpp>
+#include <audio_worker.hpp>
+#include <trace.hpp>
+#include <wav.hpp>
+
+void audio_worker::set_enabled(bool enabled) {
+	if (enabled) {
+		// turned back on before the device went quiet; there is no silence to time
+		counters.silence_requested_ns = 0;
+	}
+	if (state.exchange(enabled, std::memory_order_acq_rel) && !enabled) {
+		counters.silence_requested_ns = steady_ns();
+	}
+	wake();
+}
+
+bool audio_worker::enabled() const {
+	return state.load(std::memory_order_acquire);
+}
+
+void audio_worker::set_length(int seconds) {
+	if (len.exchange(seconds) == seconds) {
+		return;
+	}
+
+	{
+		// only generated silence has a length; a custom file or pulses carry on undisturbed
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!file_name.empty() || pulse_mode.interval > 0) {
+			return;
+		}
+		generation++;
+	}
+	wake();
+}
+
+int audio_worker::length() const {
+	return len.load();
+}
+
+void audio_worker::set_sink(const std::string& sink) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::string name = sink.empty() ? "default" : sink;
+		if (name == sink_name) {
+			return;
+		}
+		sink_name = std::move(name);
+		generation++;
+	}
+	wake();
+}
+
+std::string audio_worker::sink() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return sink_name;
+}
+
+void audio_worker::set_audio_file(const std::string& file) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (file == file_name) {
+			return;
+		}
+		file_name = file;
+		generation++;
+	}
+	wake();
+}
+
+std::string audio_worker::audio_file() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return file_name;
+}
+
+void audio_worker::set_format(const pcm_format& format) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (format == stream_format) {
+			return;
+		}
+		stream_format = format;
+		generation++;
+	}
+	wake();
+}
+
+pcm_format audio_worker::format() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stream_format;
+}
+
+void audio_worker::set_pulse(const pulse_settings& pulse) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pulse == pulse_mode) {
+			return;
+		}
+		pulse_mode = pulse;
+		generation++;
+	}
+	wake();
+}
+
+pulse_settings audio_worker::pulse() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return pulse_mode;
+}
+
+void audio_worker::suspend() {
+	{
+		std::lock_guard<std::mutex> lock(release_mutex);
+		released = false;
+	}
+	release_pending.store(true, std::memory_order_release);
+	suspended.store(true, std::memory_order_release);
+	wake();
+}
+
+bool audio_worker::wait_released(std::chrono::milliseconds timeout) {
+	std::unique_lock<std::mutex> lock(release_mutex);
+	return release_cv.wait_for(lock, timeout, [this]() { return released; });
+}
+
+void audio_worker::resume() {
+	if (!suspended.exchange(false)) {
+		return;
+	}
+	if (enabled()) {
+		counters.resume_requested_ns = steady_ns();
+	}
+	wake();
+}
+
+void audio_worker::mark_released() {
+	release_pending.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(release_mutex);
+		released = true;
+	}
+	release_cv.notify_all();
+}
+
+void audio_worker::request_quit() {
+	quit.store(true, std::memory_order_release);
+	wake();
+}
+
+void audio_worker::wake() {
+	{
+		// taking the lock orders the change before a waiter's predicate check
+		std::lock_guard<std::mutex> lock(wake_mutex);
+	}
+	wake_cv.notify_all();
+}
+
+bool audio_worker::interrupted(uint64_t started) const {
+	return quit.load(std::memory_order_acquire) || !state.load(std::memory_order_acquire) ||
+		   generation.load(std::memory_order_acquire) != started;
+}
+
+void audio_worker::wait_interruptible(std::chrono::steady_clock::duration delay, uint64_t started) {
+	std::unique_lock<std::mutex> lock(wake_mutex);
+	wake_cv.wait_for(lock, delay, [this, started]() {
+		return interrupted(started) || suspended.load(std::memory_order_acquire);
+	});
+}
+
+void audio_worker::run() {
+	int            silent_length = 0;
+	pcm_buffer     silent;
+	pulse_settings burst_settings;
+	pcm_buffer     burst;
+	int64_t        last_end      = 0; // 0 when the previous iteration did not finish
+	backoff        retry{retry_policy};
+	int64_t        failing_since = 0; // first transient error not yet recovered from
+	audio_cache    cache{audio_cache::default_directory(), cache_limit, &counters};
+
+	trace_thread_name("audio");
+
+	// the device taking frames again is what counts as recovered; one that opens
+	// and then fails its first write has not
+	auto check_recovered = [&](uint64_t writes_before) {
+		if (failing_since != 0 && counters.writes > writes_before && counters.last_open_ns > failing_since) {
+			counters.record_recovery(static_cast<uint64_t>(counters.last_open_ns - failing_since), retry.attempts());
+			failing_since = 0;
+			retry.reset();
+		}
+	};
+
+	while (!quit.load(std::memory_order_acquire)) {
+		if (suspended.load(std::memory_order_acquire)) {
+			mark_released();
+		}
+		if (!state.load(std::memory_order_acquire)) {
+			failing_since = 0;
+			retry.reset();
+
+			// turned off with no device open, e.g. while waiting to retry
+			counters.silence_requested_ns = 0;
+		}
+		if (!state.load(std::memory_order_acquire) || suspended.load(std::memory_order_acquire)) {
+			// time spent off or asleep is not a loop boundary
+			last_end = 0;
+
+			trace_span                   span("idle");
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake_cv.wait(lock, [this]() {
+				// a pending suspend goes back to the top of the loop to be acknowledged
+				return quit.load(std::memory_order_acquire) || release_pending.load(std::memory_order_acquire) ||
+					   (state.load(std::memory_order_acquire) && !suspended.load(std::memory_order_acquire));
+			});
+			continue;
+		}
+
+		const uint64_t       started = generation.load(std::memory_order_acquire);
+		const std::string    file    = audio_file();
+		const std::string    sink    = this->sink();
+		const pcm_format     format  = this->format();
+		const pulse_settings pulse   = this->pulse();
+
+		{
+			trace_span span("settings reload");
+			span.set_arg("generation", static_cast<int64_t>(started));
+
+			if (pulse.interval > 0) {
+				// custom files are for continuous playback only
+				if (burst.frames == 0 || burst_settings != pulse || burst.format != format) {
+					burst_settings = pulse;
+					burst          = generate_burst(pulse.burst, pulse.dither, format);
+				}
+			} else if (file.empty() && (silent_length != length() || silent.format != format)) {
+				silent_length = length();
+				silent        = generate_empty_sound(silent_length, format);
+			}
+		}
+
+		bool           played        = false;
+		const uint64_t writes_before = counters.writes;
+
+		try {
+			pcm_buffer custom;
+			if (!file.empty() && pulse.interval == 0) {
+				static constexpr std::chrono::milliseconds fade_in{50};
+
+				trace_span span("load audio file");
+				custom = cache.load(file, format, fade_in);
+			}
+
+			audio_manager p;
+			p.stats       = &counters;
+			p.interrupted = [this, started]() { return interrupted(started); };
+			p.suspended   = [this]() { return suspended.load(std::memory_order_acquire); };
+			p.released    = [this]() { mark_released(); };
+
+			const pcm_buffer& data        = pulse.interval > 0 ? burst : file.empty() ? silent : custom;
+			auto              burst_start = std::chrono::steady_clock::now();
+
+			if (!p.init(data
+#if LINUX
+						, sink
+#endif
+				)) {
+				throw std::runtime_error{"Failed to play audio"};
+			}
+
+			check_recovered(writes_before);
+
+			if (last_end != 0 && counters.last_open_ns > last_end) {
+				counters.record_boundary(static_cast<uint64_t>(counters.last_open_ns - last_end));
+			}
+
+			p.wait_until_done();
+
+			// pulses go on until something interrupts them, so they never count as a finished loop
+			while (pulse.interval > 0) {
+				// a burst cut short is not a pulse and must not count towards the duty cycle
+				if (interrupted(started) || suspended.load(std::memory_order_acquire)) {
+					break;
+				}
+
+				const auto burst_end = std::chrono::steady_clock::now();
+				p.hold();
+
+				counters.pulses++;
+				counters.pulse_active_ns += static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(burst_end - burst_start).count());
+
+				{
+					trace_span span("pulse idle");
+					wait_interruptible(burst_start + std::chrono::seconds(pulse.interval) - burst_end, started);
+				}
+
+				burst_start = std::chrono::steady_clock::now();
+				counters.pulse_idle_ns += static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(burst_start - burst_end).count());
+
+				if (interrupted(started) || suspended.load(std::memory_order_acquire)) {
+					break;
+				}
+
+				p.replay();
+				p.wait_until_done();
+			}
+			// a stream cut short by toggle-off, a settings change or sleep is not a finished loop
+			played = pulse.interval == 0 && !interrupted(started) && !suspended.load(std::memory_order_acquire);
+		} catch (std::exception& e) {
+			counters.errors++;
+
+			if (classify(e) == error_class::fatal) {
+				counters.fatal_errors++;
+				state         = false;
+				failing_since = 0;
+				retry.reset();
+
+				if (error_handler) {
+					error_handler(e.what(), true);
+				}
+			} else {
+				if (failing_since == 0) {
+					failing_since = steady_ns();
+				}
+
+				const auto delay = retry.next();
+				counters.retries++;
+
+				if (retry.attempts() == retry.policy().report_after && error_handler) {
+					error_handler(e.what(), false);
+				}
+
+				trace_span span("backoff");
+				span.set_arg("attempt", retry.attempts());
+				wait_interruptible(delay, started);
+			}
+		}
+
+		if (played) {
+			counters.loops++;
+			last_end = steady_ns();
+		} else {
+			last_end = 0;
+		}
+	}
+}
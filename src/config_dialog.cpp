@@ -5,12 +5,15 @@
 #include <QHBoxLayout>
 #include <QLabel>
 #include <QFileDialog>
+#include <QComboBox>
 
 config_dialog::config_dialog(int length,
 #ifdef MACOS
     bool run_on_startup,
 #endif
     std::string file,
+    const pcm_format& format,
+    const pulse_settings& pulse,
 #ifdef LINUX
     std::string sink,
 #endif
@@ -41,6 +44,41 @@ config_dialog::config_dialog(int length,
         }
     });
 
+    layout_box = new QComboBox(this);
+    for (auto layout : {channel_layout::stereo, channel_layout::surround_51, channel_layout::surround_71}) {
+        layout_box->addItem(QString::fromStdString(to_string(layout)), static_cast<int>(layout));
+    }
+    layout_box->setCurrentIndex(layout_box->findData(static_cast<int>(format.layout)));
+
+    format_box = new QComboBox(this);
+    for (auto sample : {sample_format::s16, sample_format::s24_3le, sample_format::s32, sample_format::float32}) {
+        format_box->addItem(QString::fromStdString(to_string(sample)), static_cast<int>(sample));
+    }
+    format_box->setCurrentIndex(format_box->findData(static_cast<int>(format.format)));
+
+    rate_box = new QComboBox(this);
+    for (unsigned int rate : {44100u, 48000u, 96000u}) {
+        rate_box->addItem(QString::number(rate) + " Hz", rate);
+    }
+    if (rate_box->findData(format.rate) < 0) {
+        rate_box->addItem(QString::number(format.rate) + " Hz", format.rate);
+    }
+    rate_box->setCurrentIndex(rate_box->findData(format.rate));
+
+    pulse_box = new QSpinBox(this);
+    pulse_box->setMinimum(0);
+    pulse_box->setMaximum(86400);
+    pulse_box->setValue(pulse.interval);
+    pulse_box->setSuffix(" sec");
+    pulse_box->setSpecialValueText("Off");
+    pulse_box->setToolTip("Play a short burst this often instead of streaming continuously");
+
+    dither_box = new QCheckBox("Dither", this);
+    dither_box->setChecked(pulse.dither);
+    dither_box->setToolTip("Fill bursts with inaudible noise, for receivers that ignore digital silence");
+
+    pulse_burst = pulse.burst;
+
     ok_button = new QPushButton("OK", this);
     cancel_button = new QPushButton("Cancel", this);
 
@@ -65,6 +103,20 @@ config_dialog::config_dialog(int length,
 
     main_layout->addLayout(audio_input_layout);
 
+    QHBoxLayout* format_layout = new QHBoxLayout();
+    format_layout->addWidget(new QLabel("Channels:", this));
+    format_layout->addWidget(layout_box);
+    format_layout->addWidget(new QLabel("Format:", this));
+    format_layout->addWidget(format_box);
+    format_layout->addWidget(rate_box);
+    main_layout->addLayout(format_layout);
+
+    QHBoxLayout* pulse_layout = new QHBoxLayout();
+    pulse_layout->addWidget(new QLabel("Keep-alive pulse:", this));
+    pulse_layout->addWidget(pulse_box);
+    pulse_layout->addWidget(dither_box);
+    main_layout->addLayout(pulse_layout);
+
 #ifdef LINUX
     alsa_sink_label = new QLabel("ALSA sink:", this);
     alsa_sink = new QLineEdit(this);
@@ -90,6 +142,22 @@ std::string config_dialog::custom_audio_file() const {
     return this->audio_input->text().toStdString();
 }
 
+pcm_format config_dialog::stream_format() const {
+    pcm_format format;
+    format.rate = this->rate_box->currentData().toUInt();
+    format.format = static_cast<sample_format>(this->format_box->currentData().toInt());
+    format.layout = static_cast<channel_layout>(this->layout_box->currentData().toInt());
+    return format;
+}
+
+pulse_settings config_dialog::pulse() const {
+    pulse_settings pulse;
+    pulse.interval = this->pulse_box->value();
+    pulse.burst = this->pulse_burst;
+    pulse.dither = this->dither_box->isChecked();
+    return pulse;
+}
+
 int config_dialog::audio_length() const {
 	return this->length_box->value();
 }
@@ -0,0 +1,180 @@
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QFileInfo>
+
+#include <sys/resource.h>
+
+#include <stdexcept>
+
+#include <dbus_interface.hpp>
+#include <trace.hpp>
+
+dbus_interface::dbus_interface(audio_worker& worker, QObject* parent)
+	: QObject(parent), worker(worker), started_ns(steady_ns()) {
+}
+
+bool dbus_interface::register_service() {
+	QDBusConnection bus = QDBusConnection::sessionBus();
+
+	if (!bus.isConnected()) {
+		return false;
+	}
+	if (!bus.registerObject(path, this, QDBusConnection::ExportScriptableSlots)) {
+		return false;
+	}
+
+	return bus.registerService(service);
+}
+
+bool dbus_interface::Toggle() {
+	SetEnabled(!worker.enabled());
+	return worker.enabled();
+}
+
+void dbus_interface::SetEnabled(bool enabled) {
+	if (worker.enabled() == enabled) {
+		return;
+	}
+
+	worker.set_enabled(enabled);
+	emit enabled_changed(enabled);
+}
+
+void dbus_interface::SetLength(int seconds) {
+	if (seconds < 1 || seconds > 3600) {
+		sendErrorReply(QDBusError::InvalidArgs, "Length must be between 1 and 3600 seconds");
+		return;
+	}
+
+	worker.set_length(seconds);
+	emit settings_changed();
+}
+
+void dbus_interface::SetSink(const QString& sink) {
+	worker.set_sink(sink.toStdString());
+	emit settings_changed();
+}
+
+void dbus_interface::SetAudioFile(const QString& file) {
+	if (!file.isEmpty() && !QFileInfo(file).isFile()) {
+		sendErrorReply(QDBusError::InvalidArgs, "No such file: " + file);
+		return;
+	}
+
+	worker.set_audio_file(file.toStdString());
+	emit settings_changed();
+}
+
+void dbus_interface::SetStreamFormat(const QString& format, const QString& layout, uint rate) {
+	pcm_format stream;
+
+	try {
+		stream.format = sample_format_from_string(format.toStdString());
+		stream.layout = channel_layout_from_string(layout.toStdString());
+	} catch (const std::invalid_argument& e) {
+		sendErrorReply(QDBusError::InvalidArgs, e.what());
+		return;
+	}
+
+	if (rate < 8000 || rate > 192000) {
+		sendErrorReply(QDBusError::InvalidArgs, "Rate must be between 8000 and 192000 Hz");
+		return;
+	}
+	stream.rate = rate;
+
+	worker.set_format(stream);
+	emit settings_changed();
+}
+
+void dbus_interface::SetPulse(int interval, int burst, bool dither) {
+	if (interval < 0 || interval > 86400) {
+		sendErrorReply(QDBusError::InvalidArgs, "Interval must be between 0 and 86400 seconds");
+		return;
+	}
+	if (burst < 10 || (interval > 0 && burst >= interval * 1000)) {
+		sendErrorReply(QDBusError::InvalidArgs, "Burst must be at least 10 ms and shorter than the interval");
+		return;
+	}
+
+	worker.set_pulse({interval, burst, dither});
+	emit settings_changed();
+}
+
+void dbus_interface::SetTracing(bool enabled) {
+	if (enabled) {
+		trace_enable();
+	} else {
+		trace_disable();
+	}
+}
+
+void dbus_interface::DumpTrace(const QString& path) {
+	if (!trace_dump(path.toStdString())) {
+		sendErrorReply(QDBusError::Failed, "Failed to write trace to " + path);
+	}
+}
+
+QVariantMap dbus_interface::Status() const {
+	const pcm_format     format = worker.format();
+	const pulse_settings pulse  = worker.pulse();
+
+	return {
+		{"enabled", worker.enabled()},
+		{"length", worker.length()},
+		{"sink", QString::fromStdString(worker.sink())},
+		{"audio_file", QString::fromStdString(worker.audio_file())},
+		{"sample_format", QString::fromStdString(to_string(format.format))},
+		{"channel_layout", QString::fromStdString(to_string(format.layout))},
+		{"sample_rate", format.rate},
+		{"pulse_interval", pulse.interval},
+		{"pulse_burst", pulse.burst},
+		{"pulse_dither", pulse.dither},
+		{"tracing", trace_active.load()},
+	};
+}
+
+QVariantMap dbus_interface::Counters() const {
+	const audio_stats& stats = worker.stats();
+
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+
+	const auto to_ns = [](const timeval& tv) {
+		return static_cast<uint64_t>(tv.tv_sec) * 1000000000 + static_cast<uint64_t>(tv.tv_usec) * 1000;
+	};
+	const uint64_t cpu_ns = to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+
+	return {
+		{"loops", QVariant::fromValue<qulonglong>(stats.loops.load())},
+		{"opens", QVariant::fromValue<qulonglong>(stats.opens.load())},
+		{"writes", QVariant::fromValue<qulonglong>(stats.writes.load())},
+		{"frames_written", QVariant::fromValue<qulonglong>(stats.frames_written.load())},
+		{"xruns", QVariant::fromValue<qulonglong>(stats.xruns.load())},
+		{"interrupts", QVariant::fromValue<qulonglong>(stats.interrupts.load())},
+		{"errors", QVariant::fromValue<qulonglong>(stats.errors.load())},
+		{"fatal_errors", QVariant::fromValue<qulonglong>(stats.fatal_errors.load())},
+		{"retries", QVariant::fromValue<qulonglong>(stats.retries.load())},
+		{"recoveries", QVariant::fromValue<qulonglong>(stats.recoveries.load())},
+		{"recovery_ns_total", QVariant::fromValue<qulonglong>(stats.recovery_ns_total.load())},
+		{"recovery_ns_max", QVariant::fromValue<qulonglong>(stats.recovery_ns_max.load())},
+		{"recovery_attempts_max", QVariant::fromValue<qulonglong>(stats.recovery_attempts_max.load())},
+		{"boundaries", QVariant::fromValue<qulonglong>(stats.boundaries.load())},
+		{"boundary_ns_total", QVariant::fromValue<qulonglong>(stats.boundary_ns_total.load())},
+		{"boundary_ns_max", QVariant::fromValue<qulonglong>(stats.boundary_ns_max.load())},
+		{"suspends", QVariant::fromValue<qulonglong>(stats.suspends.load())},
+		{"resumes", QVariant::fromValue<qulonglong>(stats.resumes.load())},
+		{"resume_ns_last", QVariant::fromValue<qulonglong>(stats.resume_ns_last.load())},
+		{"resume_ns_max", QVariant::fromValue<qulonglong>(stats.resume_ns_max.load())},
+		{"silences", QVariant::fromValue<qulonglong>(stats.silences.load())},
+		{"silence_ns_last", QVariant::fromValue<qulonglong>(stats.silence_ns_last.load())},
+		{"silence_ns_max", QVariant::fromValue<qulonglong>(stats.silence_ns_max.load())},
+		{"pulses", QVariant::fromValue<qulonglong>(stats.pulses.load())},
+		{"pulse_active_ns", QVariant::fromValue<qulonglong>(stats.pulse_active_ns.load())},
+		{"pulse_idle_ns", QVariant::fromValue<qulonglong>(stats.pulse_idle_ns.load())},
+		{"cache_hits", QVariant::fromValue<qulonglong>(stats.cache_hits.load())},
+		{"cache_misses", QVariant::fromValue<qulonglong>(stats.cache_misses.load())},
+		{"cache_evictions", QVariant::fromValue<qulonglong>(stats.cache_evictions.load())},
+		{"cpu_ns", QVariant::fromValue<qulonglong>(cpu_ns)},
+		{"uptime_ns", QVariant::fromValue<qulonglong>(steady_ns() - started_ns)},
+	};
+}
@@ -15,29 +15,87 @@
 #include <logo-on.svg.hpp>
 
 #include <config_dialog.hpp>
-#include <audio_manager.hpp>
+#include <audio_worker.hpp>
+#include <dbus_interface.hpp>
+#include <error_notifier.hpp>
+#if LINUX
+#include <sleep_monitor.hpp>
+#endif
 #if MACOS
 #include <launch_agent.hpp>
 #endif
 #include <setting.hpp>
+#include <soak.hpp>
 #include <svg.hpp>
-#include <wav.hpp>
+#include <trace.hpp>
 
 #include <fstream>
+#include <stdexcept>
 #include <string>
 #include <filesystem>
 #include <unistd.h>
 #include <pwd.h>
 
-std::atomic<int> length{500};
 #if MACOS
 std::atomic<bool> run_on_startup{false};
 #endif
-std::atomic<bool> state{false};
-std::string custom_audio_file{};
-std::string alsa_sink{"default"};
+
+pcm_format load_format() {
+	pcm_format format;
+	format.rate = static_cast<unsigned int>(load_setting<int>("sample_rate", 44100));
+
+	try {
+		format.format = sample_format_from_string(load_setting("sample_format", to_string(format.format)));
+		format.layout = channel_layout_from_string(load_setting("channel_layout", to_string(format.layout)));
+	} catch (const std::invalid_argument&) {
+		// keep the defaults for anything we do not recognize
+	}
+
+	return format;
+}
+
+void save_format(const pcm_format& format) {
+	save_setting("sample_rate", static_cast<int>(format.rate));
+	save_setting("sample_format", to_string(format.format));
+	save_setting("channel_layout", to_string(format.layout));
+}
+
+pulse_settings load_pulse() {
+	pulse_settings pulse;
+	pulse.interval = load_setting<int>("pulse_interval", pulse.interval);
+	pulse.burst    = load_setting<int>("pulse_burst", pulse.burst);
+	pulse.dither   = load_setting<bool>("pulse_dither", pulse.dither);
+	return pulse;
+}
+
+void save_pulse(const pulse_settings& pulse) {
+	save_setting("pulse_interval", pulse.interval);
+	save_setting("pulse_burst", pulse.burst);
+	save_setting("pulse_dither", pulse.dither);
+}
 
 int main(int argc, char *argv[]) {
+	audio_worker worker;
+
+	worker.set_enabled(load_setting<bool>("state"));
+	worker.set_length(load_setting<int>("audio_length", 500));
+	worker.set_audio_file(load_setting("custom_audio_file", std::string{}));
+	worker.set_sink(load_setting("alsa_sink", std::string{"default"}));
+	worker.set_format(load_format());
+	worker.set_pulse(load_pulse());
+	worker.cache_limit = static_cast<uintmax_t>(std::max(load_setting<int>("cache_limit_mb", 256), 1)) << 20;
+
+	if (is_soak_run(argc, argv)) {
+		return soak_main(argc, argv, worker);
+	}
+
+	// TYSTNAD_TRACE=<path> records a trace from launch and writes it there on exit
+	const std::string trace_path = qEnvironmentVariable("TYSTNAD_TRACE").toStdString();
+	if (!trace_path.empty()) {
+		trace_enable();
+		trace_thread_name("main");
+	}
+
 	QApplication::setQuitOnLastWindowClosed(false);
 
 	QApplication app(argc, argv);
@@ -49,34 +107,56 @@ int main(int argc, char *argv[]) {
 
 	auto tray_icon = std::make_shared<QSystemTrayIcon>();
 	auto tray = std::make_shared<QMenu>();
-
-	state = load_setting<bool>("state");
-	length = load_setting<int>("audio_length");
-	custom_audio_file = load_setting("custom_audio_file", custom_audio_file);
-	alsa_sink = load_setting("alsa_sink", alsa_sink);
 #if MACOS
 	run_on_startup = load_setting<bool>("run_on_startup");
 #endif
 
-	auto toggle_action = std::make_shared<QAction>(state ? "Turn Off" : "Turn On");
+	auto toggle_action = std::make_shared<QAction>(worker.enabled() ? "Turn Off" : "Turn On");
 	auto quit_action = std::make_shared<QAction>("Quit");
 	auto about_action = std::make_shared<QAction>("About");
 	auto configure_action = std::make_shared<QAction>("Configure");
 
-	tray_icon->setIcon(icon_from_svg(state ? logo_on_svg : logo_off_svg, QSize(64, 32)));
+	tray_icon->setIcon(icon_from_svg(worker.enabled() ? logo_on_svg : logo_off_svg, QSize(64, 32)));
 	tray_icon->setToolTip("tystnad");
 	tray_icon->setContextMenu(tray.get());
 	tray_icon->show();
 
-	QObject::connect(toggle_action.get(), &QAction::triggered, [=]() mutable {
-		state = !state;
+	auto dbus = std::make_shared<dbus_interface>(worker);
+
+	if (!dbus->register_service()) {
+		std::cerr << "Failed to register D-Bus service " << dbus_interface::service << "\n";
+	}
+
+#if LINUX
+	auto sleep_watch = std::make_shared<sleep_monitor>(worker);
+
+	if (!sleep_watch->start()) {
+		std::cerr << "Failed to subscribe to logind PrepareForSleep\n";
+	}
+#endif
 
-		save_setting("state", state.load());
+	auto show_state = [=](bool enabled) {
+		save_setting("state", enabled);
 
-		toggle_action->setText(state ? "Turn Off" : "Turn On");
+		toggle_action->setText(enabled ? "Turn Off" : "Turn On");
 
-		QIcon icon = icon_from_svg(state ? logo_on_svg : logo_off_svg, QSize(64, 32));
+		QIcon icon = icon_from_svg(enabled ? logo_on_svg : logo_off_svg, QSize(64, 32));
 		tray_icon->setIcon(icon);
+	};
+
+	QObject::connect(toggle_action.get(), &QAction::triggered, [=, &worker]() mutable {
+		worker.set_enabled(!worker.enabled());
+		show_state(worker.enabled());
+	});
+	QObject::connect(dbus.get(), &dbus_interface::enabled_changed, show_state);
+	QObject::connect(dbus.get(), &dbus_interface::settings_changed, [&worker]() {
+		save_setting("audio_length", worker.length());
+		save_setting("custom_audio_file", worker.audio_file());
+		save_format(worker.format());
+		save_pulse(worker.pulse());
+#if LINUX
+		save_setting("alsa_sink", worker.sink());
+#endif
 	});
 	QObject::connect(about_action.get(), &QAction::triggered, [=]() mutable {
 		QDialog dialog;
@@ -120,28 +200,32 @@ int main(int argc, char *argv[]) {
 
 		dialog.exec();
 	});
-	QObject::connect(configure_action.get(), &QAction::triggered, [=]() mutable {
+	QObject::connect(configure_action.get(), &QAction::triggered, [=, &worker]() mutable {
 	#if MACOS
-		auto* dialog = new config_dialog(length.load(), run_on_startup.load(), custom_audio_file, nullptr);
+		auto* dialog = new config_dialog(worker.length(), run_on_startup.load(), worker.audio_file(), worker.format(), worker.pulse(), nullptr);
 	#else
-		auto* dialog = new config_dialog(length.load(), custom_audio_file, alsa_sink, nullptr);
+		auto* dialog = new config_dialog(worker.length(), worker.audio_file(), worker.format(), worker.pulse(), worker.sink(), nullptr);
 	#endif
 
-		QObject::connect(dialog, &QDialog::accepted, [=]() {
+		QObject::connect(dialog, &QDialog::accepted, [=, &worker]() {
 			// get from the dialog and immediately save
-			length = dialog->audio_length();
-			custom_audio_file = dialog->custom_audio_file();
+			worker.set_length(dialog->audio_length());
+			worker.set_audio_file(dialog->custom_audio_file());
+			worker.set_format(dialog->stream_format());
+			worker.set_pulse(dialog->pulse());
 #if LINUX
-			alsa_sink = dialog->get_alsa_sink();
+			worker.set_sink(dialog->get_alsa_sink());
 #endif
 	#if MACOS
 			run_on_startup = dialog->run_on_startup();
 	#endif
 
-			save_setting("audio_length", length.load());
-			save_setting("custom_audio_file", custom_audio_file);
+			save_setting("audio_length", worker.length());
+			save_setting("custom_audio_file", worker.audio_file());
+			save_format(worker.format());
+			save_pulse(worker.pulse());
 #if LINUX
-			save_setting("alsa_sink", alsa_sink.empty() ? "default" : alsa_sink);
+			save_setting("alsa_sink", worker.sink());
 #endif
 	#if MACOS
 			save_setting("run_on_startup", run_on_startup.load());
@@ -170,67 +254,35 @@ int main(int argc, char *argv[]) {
 	tray->addAction(about_action.get());
 	tray->addAction(configure_action.get());
 
-	int initial_length = length;
-	auto silent = generate_empty_sound(length);
-
-	std::atomic<bool> applied = false;
-
-	// hacky but works?
-	std::thread t([&]() {
-		while (true) { //NOLINT
-			if (state.load(std::memory_order_acquire)) {
-				audio_manager p;
-
-				if (!applied && custom_audio_file.empty()) {
-					applied = true;
-
-					static constexpr int duration = 50;
-					static constexpr int rate = 44100;
-					static constexpr int channels = 2;
-					static constexpr int fade_in = (duration * rate) / 1000;
+	auto notifier = std::make_shared<error_notifier>();
 
-					apply_fade_in(silent, fade_in, channels);
-				}
-
-				try {
-					if (!custom_audio_file.empty()) {
-						if (!p.init(custom_audio_file
-#if LINUX
-									, alsa_sink.empty() ? "default" : alsa_sink
-#endif
-							   )) {
-							throw std::runtime_error{"Failed to play audio"};
-						}
-					} else {
-						if (!p.init(silent
-#if LINUX
-									, alsa_sink.empty() ? "default" : alsa_sink
-#endif
-							   )) {
-							throw std::runtime_error{"Failed to play audio"};
-						}
-					}
+	QObject::connect(notifier.get(), &error_notifier::error, notifier.get(), [=](const QString& message, bool fatal) {
+		if (fatal) {
+			show_state(false);
+			QMessageBox::critical(nullptr, "Error", QString("An error occurred:\n%1").arg(message));
+		} else {
+			tray_icon->showMessage("tystnad", QString("Audio device unavailable, retrying:\n%1").arg(message),
+				QSystemTrayIcon::Warning);
+		}
+	}, Qt::QueuedConnection);
 
-					p.wait_until_done();
-				} catch (std::exception& e) {
-					QMessageBox::critical(nullptr, "Error", QString("An error occurred:\n%1").arg(e.what()));
-					state = false;
+	worker.error_handler = [notifier](const std::string& what, bool fatal) {
+		emit notifier->error(QString::fromStdString(what), fatal);
+	};
 
-				}
+	std::thread t([&worker]() {
+		worker.run();
+	});
 
-				if (initial_length != length && custom_audio_file.empty()) {
-					silent = generate_empty_sound(length);
-					applied = false;
-				}
+	const int ret = QApplication::exec();
 
-				initial_length = length;
-			} else {
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
-			}
-		}
-	}); //NOLINT
+	// the worker fades out and closes the device on its own once it sees the quit
+	worker.request_quit();
+	t.join();
 
-	t.detach();
+	if (!trace_path.empty() && !trace_dump(trace_path)) {
+		std::cerr << "Failed to write trace to " << trace_path << "\n";
+	}
 
-	return QApplication::exec();
+	return ret;
 }
@@ -0,0 +1,92 @@
+#include <stdexcept>
+
+#include <pcm_format.hpp>
+
+unsigned int channel_count(channel_layout layout) {
+	switch (layout) {
+	case channel_layout::surround_51:
+		return 6;
+	case channel_layout::surround_71:
+		return 8;
+	case channel_layout::stereo:
+	default:
+		return 2;
+	}
+}
+
+unsigned int pcm_format::channels() const {
+	return channel_count(layout);
+}
+
+size_t pcm_format::sample_bytes() const {
+	switch (format) {
+	case sample_format::s24_3le:
+		return 3;
+	case sample_format::s32:
+	case sample_format::float32:
+		return 4;
+	case sample_format::s16:
+	default:
+		return 2;
+	}
+}
+
+std::string to_string(sample_format format) {
+	switch (format) {
+	case sample_format::s24_3le:
+		return "S24_3LE";
+	case sample_format::s32:
+		return "S32";
+	case sample_format::float32:
+		return "FLOAT";
+	case sample_format::s16:
+	default:
+		return "S16";
+	}
+}
+
+std::string to_string(channel_layout layout) {
+	switch (layout) {
+	case channel_layout::surround_51:
+		return "5.1";
+	case channel_layout::surround_71:
+		return "7.1";
+	case channel_layout::stereo:
+	default:
+		return "2.0";
+	}
+}
+
+sample_format sample_format_from_string(const std::string& str) {
+	for (auto format : {sample_format::s16, sample_format::s24_3le, sample_format::s32, sample_format::float32}) {
+		if (to_string(format) == str) {
+			return format;
+		}
+	}
+	throw std::invalid_argument{"Unknown sample format: " + str};
+}
+
+channel_layout channel_layout_from_string(const std::string& str) {
+	for (auto layout : {channel_layout::stereo, channel_layout::surround_51, channel_layout::surround_71}) {
+		if (to_string(layout) == str) {
+			return layout;
+		}
+	}
+	throw std::invalid_argument{"Unknown channel layout: " + str};
+}
+
+void apply_fade(const pcm_format& format, char* data, size_t frames, size_t fade_length, fade direction) {
+	dispatch_format(format, [&](auto f, auto c) {
+		if (direction == fade::in) {
+			fade_frames<decltype(f)::value, decltype(c)::value, fade::in>(data, frames, fade_length);
+		} else {
+			fade_frames<decltype(f)::value, decltype(c)::value, fade::out>(data, frames, fade_length);
+		}
+	});
+}
+
+void fill_dither(const pcm_format& format, char* data, size_t frames, float amplitude) {
+	dispatch_format(format, [&](auto f, auto c) {
+		dither_frames<decltype(f)::value, decltype(c)::value>(data, frames, amplitude);
+	});
+}
@@ -0,0 +1,77 @@
+#include <QDBusInterface>
+#include <QDBusReply>
+#include <QtGlobal>
+
+#include <chrono>
+#include <iostream>
+
+#include <sleep_monitor.hpp>
+
+namespace {
+constexpr const char* path      = "/org/freedesktop/login1";
+constexpr const char* interface = "org.freedesktop.login1.Manager";
+
+QDBusConnection logind_bus() {
+	if (qEnvironmentVariable("TYSTNAD_LOGIND_BUS") == "session") {
+		return QDBusConnection::sessionBus();
+	}
+	return QDBusConnection::systemBus();
+}
+
+QString logind_service() {
+	if (qEnvironmentVariableIsSet("TYSTNAD_LOGIND_SERVICE")) {
+		return qEnvironmentVariable("TYSTNAD_LOGIND_SERVICE");
+	}
+	return "org.freedesktop.login1";
+}
+} // namespace
+
+sleep_monitor::sleep_monitor(audio_worker& worker, QObject* parent)
+	: QObject(parent), worker(worker), bus(logind_bus()), service(logind_service()) {
+}
+
+bool sleep_monitor::start() {
+	if (!bus.isConnected()) {
+		return false;
+	}
+	if (!bus.connect(service, path, interface, "PrepareForSleep", this, SLOT(prepare_for_sleep(bool)))) {
+		return false;
+	}
+
+	take_inhibitor();
+	return true;
+}
+
+void sleep_monitor::take_inhibitor() {
+	if (service.isEmpty()) {
+		return;
+	}
+
+	QDBusInterface logind(service, path, interface, bus);
+
+	QDBusReply<QDBusUnixFileDescriptor> reply = logind.call(QStringLiteral("Inhibit"), QStringLiteral("sleep"),
+		QStringLiteral("tystnad"), QStringLiteral("Release the audio device before sleep"), QStringLiteral("delay"));
+
+	if (reply.isValid()) {
+		inhibitor = reply.value();
+	} else {
+		std::cerr << "Failed to take sleep inhibitor: " << reply.error().message().toStdString() << "\n";
+	}
+}
+
+void sleep_monitor::prepare_for_sleep(bool sleeping) {
+	if (sleeping) {
+		static constexpr std::chrono::milliseconds release_timeout{2000};
+
+		worker.suspend();
+		if (!worker.wait_released(release_timeout)) {
+			std::cerr << "Audio device not released before sleep\n";
+		}
+
+		// closing the descriptor tells logind we are ready
+		inhibitor = QDBusUnixFileDescriptor();
+	} else {
+		worker.resume();
+		take_inhibitor();
+	}
+}
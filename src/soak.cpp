@@ -0,0 +1,310 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <soak.hpp>
+#include <trace.hpp>
+
+namespace {
+struct soak_sample {
+	double   elapsed_s;
+	double   user_s;
+	double   sys_s;
+	long     voluntary_switches;
+	long     involuntary_switches;
+	long     rss_kb;
+	uint64_t loops;
+	uint64_t writes;
+	uint64_t xruns;
+};
+
+double to_seconds(const timeval& tv) {
+	return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6;
+}
+
+long resident_kb() {
+#if LINUX
+	std::ifstream statm("/proc/self/statm");
+	long          pages    = 0;
+	long          resident = 0;
+	if (statm >> pages >> resident) {
+		return resident * (sysconf(_SC_PAGESIZE) / 1024);
+	}
+	return 0;
+#else
+	// no cheap current-RSS query here, ru_maxrss (bytes on macOS) is the best we get
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+#endif
+}
+
+soak_sample take_sample(double elapsed_s, const audio_stats& stats) {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+
+	return {
+		elapsed_s,
+		to_seconds(usage.ru_utime),
+		to_seconds(usage.ru_stime),
+		usage.ru_nvcsw,
+		usage.ru_nivcsw,
+		resident_kb(),
+		stats.loops,
+		stats.writes,
+		stats.xruns,
+	};
+}
+
+void write_report(std::ostream& out, const audio_worker& worker, const std::vector<soak_sample>& samples,
+	const std::string& error) {
+	const audio_stats& stats = worker.stats();
+	const soak_sample& first = samples.front();
+	const soak_sample& last  = samples.back();
+
+	const double elapsed = last.elapsed_s - first.elapsed_s;
+	const double cpu     = (last.user_s - first.user_s) + (last.sys_s - first.sys_s);
+	const long   wakeups = last.voluntary_switches - first.voluntary_switches;
+
+	long rss_max = 0;
+	for (const auto& it : samples) {
+		rss_max = std::max(rss_max, it.rss_kb);
+	}
+
+	const uint64_t       boundaries = stats.boundaries;
+	const uint64_t       pulse_ns   = stats.pulse_active_ns + stats.pulse_idle_ns;
+	const pulse_settings pulse      = worker.pulse();
+	const uint64_t       lookups    = stats.cache_hits + stats.cache_misses;
+
+	out << std::fixed << std::setprecision(3);
+	out << "tystnad soak report\n";
+#ifdef TYSTNAD_VERSION
+	out << "version: " << TYSTNAD_VERSION << "\n";
+#endif
+	out << "sink: " << worker.sink() << "\n";
+	out << "audio_file: " << (worker.audio_file().empty() ? "(silence)" : worker.audio_file()) << "\n";
+	out << "length_s: " << worker.length() << "\n";
+	out << "format: " << to_string(worker.format().format) << " " << to_string(worker.format().layout) << " "
+		<< worker.format().rate << "\n";
+	if (pulse.interval > 0) {
+		out << "pulse: every " << pulse.interval << " s, " << pulse.burst << " ms of "
+			<< (pulse.dither ? "dither" : "silence") << "\n";
+	}
+	out << "elapsed_s: " << elapsed << "\n";
+	out << "error: " << (error.empty() ? "none" : error) << "\n";
+	out << "\n";
+	out << "loops: " << stats.loops << "\n";
+	out << "opens: " << stats.opens << "\n";
+	out << "writes: " << stats.writes << "\n";
+	out << "frames_written: " << stats.frames_written << "\n";
+	out << "xruns: " << stats.xruns << "\n";
+	out << "errors: " << stats.errors << "\n";
+	out << "fatal_errors: " << stats.fatal_errors << "\n";
+	out << "retries: " << stats.retries << "\n";
+	out << "recoveries: " << stats.recoveries << "\n";
+	out << "recovery_ms_max: " << static_cast<double>(stats.recovery_ns_max) / 1e6 << "\n";
+	out << "recovery_attempts_max: " << stats.recovery_attempts_max << "\n";
+	out << "boundaries: " << boundaries << "\n";
+	out << "boundary_ms_avg: "
+		<< (boundaries ? static_cast<double>(stats.boundary_ns_total) / boundaries / 1e6 : 0.0) << "\n";
+	out << "boundary_ms_max: " << static_cast<double>(stats.boundary_ns_max) / 1e6 << "\n";
+	out << "suspends: " << stats.suspends << "\n";
+	out << "resumes: " << stats.resumes << "\n";
+	out << "resume_ms_max: " << static_cast<double>(stats.resume_ns_max) / 1e6 << "\n";
+	out << "cache_hits: " << stats.cache_hits << "\n";
+	out << "cache_misses: " << stats.cache_misses << "\n";
+	out << "cache_hit_rate_percent: "
+		<< (lookups ? static_cast<double>(stats.cache_hits) / lookups * 100.0 : 0.0) << "\n";
+	out << "pulses: " << stats.pulses << "\n";
+	out << "duty_cycle_percent: "
+		<< (pulse_ns ? static_cast<double>(stats.pulse_active_ns) / pulse_ns * 100.0 : 100.0) << "\n";
+	out << "\n";
+	out << "cpu_user_s: " << last.user_s - first.user_s << "\n";
+	out << "cpu_sys_s: " << last.sys_s - first.sys_s << "\n";
+	out << "cpu_percent: " << (elapsed > 0 ? cpu / elapsed * 100.0 : 0.0) << "\n";
+	out << "voluntary_switches: " << wakeups << "\n";
+	out << "involuntary_switches: " << last.involuntary_switches - first.involuntary_switches << "\n";
+	out << "wakeups_per_s: " << (elapsed > 0 ? wakeups / elapsed : 0.0) << "\n";
+	out << "rss_start_kb: " << first.rss_kb << "\n";
+	out << "rss_end_kb: " << last.rss_kb << "\n";
+	out << "rss_max_kb: " << rss_max << "\n";
+	out << "rss_growth_kb: " << last.rss_kb - first.rss_kb << "\n";
+	out << "\n";
+	out << "# elapsed_s user_s sys_s nvcsw nivcsw rss_kb loops writes xruns\n";
+	for (const auto& it : samples) {
+		out << it.elapsed_s << " " << it.user_s << " " << it.sys_s << " " << it.voluntary_switches << " "
+			<< it.involuntary_switches << " " << it.rss_kb << " " << it.loops << " " << it.writes << " "
+			<< it.xruns << "\n";
+	}
+}
+} // namespace
+
+bool is_soak_run(int argc, char* argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--soak") == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int soak_main(int argc, char* argv[], audio_worker& worker) {
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("tystnad soak test");
+	parser.addHelpOption();
+
+	QCommandLineOption soak_option("soak", "Run the worker loop for <seconds> and write a report.", "seconds");
+	QCommandLineOption sink_option("sink", "ALSA sink to play to, e.g. null.", "sink");
+	QCommandLineOption file_option("file", "Custom audio file to play instead of silence.", "file");
+	QCommandLineOption length_option("length", "Length of the generated silence.", "seconds");
+	QCommandLineOption format_option("format", "Sample format: S16, S24_3LE, S32 or FLOAT.", "format");
+	QCommandLineOption layout_option("layout", "Channel layout: 2.0, 5.1 or 7.1.", "layout");
+	QCommandLineOption rate_option("rate", "Sample rate in Hz.", "rate");
+	QCommandLineOption pulse_option("pulse", "Play a keep-alive burst every <seconds> instead of streaming.", "seconds");
+	QCommandLineOption burst_option("burst", "Length of each keep-alive burst.", "ms", "500");
+	QCommandLineOption dither_option("dither", "Fill keep-alive bursts with low-level dither instead of silence.");
+	QCommandLineOption interval_option("interval", "Seconds between samples.", "seconds", "10");
+	QCommandLineOption report_option("report", "Where to write the report.", "path", "tystnad-soak.txt");
+	QCommandLineOption trace_option("trace", "Record a Chrome trace of the audio thread and write it to <path>.", "path");
+
+	parser.addOptions({soak_option, sink_option, file_option, length_option, format_option, layout_option,
+		rate_option, pulse_option, burst_option, dither_option, interval_option, report_option,
+		trace_option});
+	parser.process(app);
+
+	bool      ok       = false;
+	const int duration = parser.value(soak_option).toInt(&ok);
+	if (!ok || duration <= 0) {
+		std::cerr << "--soak needs a positive number of seconds\n";
+		return 1;
+	}
+	const int interval = std::max(1, parser.value(interval_option).toInt());
+
+	if (parser.isSet(sink_option)) {
+		worker.set_sink(parser.value(sink_option).toStdString());
+	}
+	if (parser.isSet(file_option)) {
+		worker.set_audio_file(parser.value(file_option).toStdString());
+	}
+	if (parser.isSet(length_option)) {
+		worker.set_length(std::clamp(parser.value(length_option).toInt(), 1, 3600));
+	}
+	if (parser.isSet(pulse_option)) {
+		pulse_settings pulse;
+		pulse.interval = std::clamp(parser.value(pulse_option).toInt(), 0, 86400);
+		pulse.burst    = std::clamp(parser.value(burst_option).toInt(), 10, std::max(10, pulse.interval * 1000 - 1));
+		pulse.dither   = parser.isSet(dither_option);
+		worker.set_pulse(pulse);
+	}
+
+	try {
+		pcm_format format = worker.format();
+		if (parser.isSet(format_option)) {
+			format.format = sample_format_from_string(parser.value(format_option).toStdString());
+		}
+		if (parser.isSet(layout_option)) {
+			format.layout = channel_layout_from_string(parser.value(layout_option).toStdString());
+		}
+		if (parser.isSet(rate_option)) {
+			format.rate = std::clamp(parser.value(rate_option).toUInt(), 8000u, 192000u);
+		}
+		worker.set_format(format);
+	} catch (const std::invalid_argument& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+
+	std::mutex              error_mutex;
+	std::condition_variable error_cv;
+	std::string             error;
+	bool                    failed = false;
+	worker.error_handler = [&](const std::string& what, bool fatal) {
+		if (!fatal) {
+			std::cerr << "Retrying: " << what << "\n";
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+			error  = what;
+			failed = true;
+		}
+		error_cv.notify_all();
+	};
+
+	std::vector<soak_sample> samples;
+	const auto               start    = std::chrono::steady_clock::now();
+	const auto               deadline = start + std::chrono::seconds(duration);
+
+	auto elapsed = [start]() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	if (parser.isSet(trace_option)) {
+		trace_enable();
+	}
+
+	samples.push_back(take_sample(0.0, worker.stats()));
+
+	worker.set_enabled(true);
+	std::thread t([&worker]() {
+		worker.run();
+	});
+
+	// sleep until the next sample without polling, so the sampler adds no wakeups of its own;
+	// a fatal error ends the run early
+	auto next = start;
+	while (next < deadline) {
+		next = std::min(next + std::chrono::seconds(interval), deadline);
+		{
+			std::unique_lock<std::mutex> lock(error_mutex);
+			if (error_cv.wait_until(lock, next, [&failed]() { return failed; })) {
+				break;
+			}
+		}
+		samples.push_back(take_sample(elapsed(), worker.stats()));
+	}
+
+	worker.request_quit();
+	t.join();
+
+	samples.push_back(take_sample(elapsed(), worker.stats()));
+
+	const std::string path = parser.value(report_option).toStdString();
+	std::ofstream     report(path);
+	if (!report) {
+		std::cerr << "Failed to open report file: " << path << "\n";
+		return 1;
+	}
+
+	std::lock_guard<std::mutex> lock(error_mutex);
+	write_report(report, worker, samples, error);
+	std::cout << "Soak report written to " << path << "\n";
+
+	if (parser.isSet(trace_option)) {
+		const std::string trace_path = parser.value(trace_option).toStdString();
+		if (trace_dump(trace_path)) {
+			std::cout << "Trace written to " << trace_path << "\n";
+		} else {
+			std::cerr << "Failed to write trace to " << trace_path << "\n";
+		}
+	}
+
+	return failed ? 1 : 0;
+}
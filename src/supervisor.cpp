@@ -0,0 +1,48 @@
+#ifdef MACOS
+#include <AudioToolbox/AudioToolbox.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+
+#include <supervisor.hpp>
+
+error_class classify(const std::exception& e) {
+	const auto* audio = dynamic_cast<const audio_error*>(&e);
+	if (!audio) {
+		// unreadable files, unknown formats and the like
+		return error_class::fatal;
+	}
+
+#if LINUX
+	switch (-audio->code) {
+	case EBUSY:
+	case EAGAIN:
+	case EINTR:
+	case EPIPE:
+	case ESTRPIPE:
+	case EIO:
+	case ENODEV:
+	case ENXIO:
+		return error_class::transient;
+	default:
+		return error_class::fatal;
+	}
+#else
+	return audio->code == kAudioFormatUnsupportedDataFormatError ? error_class::fatal : error_class::transient;
+#endif
+}
+
+backoff::backoff(const backoff_policy& policy) : settings(policy), rng(std::random_device{}()) {
+}
+
+std::chrono::milliseconds backoff::next() {
+	const double base = static_cast<double>(settings.initial.count()) * std::pow(settings.multiplier, failures);
+	const double cap  = std::min(base, static_cast<double>(settings.max.count()));
+
+	std::uniform_real_distribution<double> spread(1.0 - settings.jitter, 1.0);
+	failures++;
+
+	return std::chrono::milliseconds{static_cast<long long>(cap * spread(rng))};
+}
@@ -0,0 +1,189 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <trace.hpp>
+
+namespace {
+// one event, split into relaxed atomics so the dumping thread can read a slot
+// the owner is overwriting without a data race; such slots are discarded
+struct trace_slot {
+	std::atomic<const char*> name{nullptr};
+	std::atomic<int64_t>     start_ns{0};
+	std::atomic<int64_t>     end_ns{0};
+	std::atomic<const char*> arg_name{nullptr};
+	std::atomic<int64_t>     arg{0};
+};
+
+struct trace_event {
+	const char* name;
+	int64_t     start_ns;
+	int64_t     end_ns;
+	const char* arg_name;
+	int64_t     arg;
+};
+
+// single writer (the owning thread), any number of readers
+class trace_ring {
+public:
+	trace_ring(size_t capacity, unsigned int tid) : slots(new trace_slot[capacity]), mask(capacity - 1), tid(tid) {}
+
+	void push(const trace_event& event) {
+		const uint64_t index = head.load(std::memory_order_relaxed);
+		trace_slot&    slot  = slots[index & mask];
+
+		// pairs with the fence in snapshot(): a reader that sees any of the stores below
+		// also sees head at index or later, and drops the slot as overwritten
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.name.store(event.name, std::memory_order_relaxed);
+		slot.start_ns.store(event.start_ns, std::memory_order_relaxed);
+		slot.end_ns.store(event.end_ns, std::memory_order_relaxed);
+		slot.arg_name.store(event.arg_name, std::memory_order_relaxed);
+		slot.arg.store(event.arg, std::memory_order_relaxed);
+
+		head.store(index + 1, std::memory_order_release);
+	}
+
+	std::vector<trace_event> snapshot() const {
+		const uint64_t capacity = mask + 1;
+		const uint64_t end      = head.load(std::memory_order_acquire);
+		const uint64_t begin    = end > capacity ? end - capacity : 0;
+
+		std::vector<trace_event> events;
+		events.reserve(end - begin);
+		for (uint64_t i = begin; i < end; ++i) {
+			const trace_slot& slot = slots[i & mask];
+			events.push_back({slot.name.load(std::memory_order_relaxed), slot.start_ns.load(std::memory_order_relaxed),
+				slot.end_ns.load(std::memory_order_relaxed), slot.arg_name.load(std::memory_order_relaxed),
+				slot.arg.load(std::memory_order_relaxed)});
+		}
+
+		// the writer may have lapped the oldest slots while they were copied
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t after = head.load(std::memory_order_relaxed);
+		const uint64_t valid = after >= capacity ? after - capacity + 1 : 0;
+		if (valid > begin) {
+			events.erase(events.begin(), events.begin() + static_cast<std::ptrdiff_t>(std::min(valid, end) - begin));
+		}
+
+		return events;
+	}
+
+	std::string  thread_name;
+	unsigned int thread_id() const { return tid; }
+
+private:
+	std::unique_ptr<trace_slot[]> slots;
+	uint64_t                      mask;
+	unsigned int                  tid;
+	std::atomic<uint64_t>         head{0};
+};
+
+std::mutex                               registry_mutex;
+std::vector<std::shared_ptr<trace_ring>> rings;
+std::atomic<size_t>                      ring_capacity{65536};
+
+thread_local std::shared_ptr<trace_ring> local_ring;
+thread_local std::string                 local_name;
+
+trace_ring* ring_for_this_thread() {
+	if (!local_ring) {
+		std::lock_guard<std::mutex> lock(registry_mutex);
+
+		local_ring = std::make_shared<trace_ring>(ring_capacity.load(), static_cast<unsigned int>(rings.size() + 1));
+		local_ring->thread_name = local_name;
+		rings.push_back(local_ring);
+	}
+	return local_ring.get();
+}
+
+void write_string(std::ostream& out, const std::string& str) {
+	out << '"';
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			out << ' ';
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+} // namespace
+
+void trace_enable(size_t events_per_thread) {
+	size_t capacity = 1;
+	while (capacity < events_per_thread) {
+		capacity <<= 1;
+	}
+
+	ring_capacity.store(capacity);
+	trace_active.store(true);
+}
+
+void trace_disable() {
+	trace_active.store(false);
+}
+
+void trace_thread_name(const std::string& name) {
+	local_name = name;
+
+	if (local_ring) {
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		local_ring->thread_name = name;
+	}
+}
+
+void trace_record(const char* name, int64_t start_ns, int64_t end_ns, const char* arg_name, int64_t arg) {
+	ring_for_this_thread()->push({name, start_ns, end_ns, arg_name, arg});
+}
+
+bool trace_dump(const std::string& path) {
+	std::ofstream out(path);
+	if (!out) {
+		return false;
+	}
+
+	const auto pid = static_cast<long>(getpid());
+
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	std::lock_guard<std::mutex> lock(registry_mutex);
+
+	bool first = true;
+	for (const auto& ring : rings) {
+		if (!ring->thread_name.empty()) {
+			out << (first ? "\n" : ",\n") << R"({"name":"thread_name","ph":"M","pid":)" << pid
+				<< ",\"tid\":" << ring->thread_id() << ",\"args\":{\"name\":";
+			write_string(out, ring->thread_name);
+			out << "}}";
+			first = false;
+		}
+
+		for (const auto& event : ring->snapshot()) {
+			out << (first ? "\n" : ",\n") << "{\"name\":";
+			write_string(out, event.name);
+			out << ",\"ph\":\"X\",\"ts\":" << static_cast<double>(event.start_ns) / 1e3
+				<< ",\"dur\":" << static_cast<double>(event.end_ns - event.start_ns) / 1e3 << ",\"pid\":" << pid
+				<< ",\"tid\":" << ring->thread_id();
+			if (event.arg_name) {
+				out << ",\"args\":{";
+				write_string(out, event.arg_name);
+				out << ":" << event.arg << "}";
+			}
+			out << "}";
+			first = false;
+		}
+	}
+
+	out << "\n]}\n";
+	return static_cast<bool>(out);
+}
@@ -1,76 +1,221 @@
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
 #include <vector>
 #include <wav.hpp>
 
-void apply_fade_in(std::vector<char>& buffer, int in_samples, int channels) {
-   	auto* samples = reinterpret_cast<int16_t*>(buffer.data());
-   	auto total = buffer.size() / sizeof(int16_t);
+namespace {
+uint16_t read_le16(const std::vector<char>& bytes, size_t pos) {
+	return static_cast<uint16_t>(static_cast<uint8_t>(bytes[pos]) | static_cast<uint8_t>(bytes[pos + 1]) << 8);
+}
+
+uint32_t read_le32(const std::vector<char>& bytes, size_t pos) {
+	return static_cast<uint32_t>(read_le16(bytes, pos)) | static_cast<uint32_t>(read_le16(bytes, pos + 2)) << 16;
+}
+
+sample_format wav_sample_format(uint16_t audio_format, uint16_t bits_per_sample) {
+	static constexpr uint16_t pcm = 1;
+	static constexpr uint16_t ieee_float = 3;
+
+	if (audio_format == pcm && bits_per_sample == 16) {
+		return sample_format::s16;
+	}
+	if (audio_format == pcm && bits_per_sample == 24) {
+		return sample_format::s24_3le;
+	}
+	if (audio_format == pcm && bits_per_sample == 32) {
+		return sample_format::s32;
+	}
+	if (audio_format == ieee_float && bits_per_sample == 32) {
+		return sample_format::float32;
+	}
+
+	throw std::runtime_error{"Unsupported WAV format: " + std::to_string(audio_format) + ", " +
+							 std::to_string(bits_per_sample) + " bits"};
+}
+
+/*
+ * For every target channel, which source channel feeds it, or -1 for none.
+ * Mono is sent to both front channels; anything else is matched by WAV
+ * position. ALSA's default 5.1/7.1 map puts the rear pair before center and
+ * LFE, so reorder for it there.
+ */
+void channel_map(unsigned int source_channels, const pcm_format& target, int (&map)[8]) {
+	const unsigned int channels = target.channels();
+
+	for (unsigned int ch = 0; ch < 8; ++ch) {
+		if (ch >= channels) {
+			map[ch] = -1;
+		} else if (source_channels == 1) {
+			map[ch] = ch < 2 ? 0 : -1;
+		} else {
+			map[ch] = ch < source_channels ? static_cast<int>(ch) : -1;
+		}
+	}
+
+#if LINUX
+	if (channels > 2) {
+		static constexpr unsigned int alsa_order[8] = {0, 1, 4, 5, 2, 3, 6, 7};
+
+		int wav[8];
+		std::memcpy(wav, map, sizeof(wav));
+		for (unsigned int ch = 0; ch < channels; ++ch) {
+			map[ch] = wav[alsa_order[ch]];
+		}
+	}
+#endif
+}
+
+template <sample_format S, sample_format F, unsigned int C>
+void convert_frames(const char* src, unsigned int source_channels, size_t frames, const int (&map)[8], char* dst) {
+	using in  = sample_traits<S>;
+	using out = sample_traits<F>;
+
+	for (size_t frame = 0; frame < frames; ++frame) {
+		const char* from = src + frame * source_channels * in::bytes;
+		char*       to   = dst + frame * C * out::bytes;
+
+		for (unsigned int ch = 0; ch < C; ++ch) {
+			out::write(to + ch * out::bytes, map[ch] < 0 ? 0.f : in::read(from + map[ch] * in::bytes));
+		}
+	}
+}
+
+template <sample_format S>
+void convert(const char* src, unsigned int source_channels, size_t frames, const pcm_format& target, char* dst) {
+	int map[8];
+	channel_map(source_channels, target, map);
+
+	dispatch_format(target, [&](auto f, auto c) {
+		convert_frames<S, decltype(f)::value, decltype(c)::value>(src, source_channels, frames, map, dst);
+	});
+}
+} // namespace
 
-   	int frames = std::min(in_samples, static_cast<int>(total / channels));
+void apply_fade_in(pcm_buffer& buffer, size_t in_frames) {
+	// only owned data; mapped buffers are read-only and were faded before they were cached
+	apply_fade(buffer.format, buffer.data.data(), buffer.data.size() / buffer.format.frame_bytes(), in_frames, fade::in);
+}
 
-   	for (int frame = 0; frame < frames; ++frame) {
-   		float gain = static_cast<float>(frame) / static_cast<float>(frames);
+pcm_buffer generate_empty_sound(int duration_seconds, const pcm_format& format) {
+	// a tenth of a second, repeated; all-zero bytes are silence in every supported format
+	const size_t chunk_frames = format.rate / 10;
 
-   		for (int ch = 0; ch < channels; ++ch) {
-   			int idx = frame * channels + ch;
-   			int16_t sample = samples[idx];
+	pcm_buffer buffer;
+	buffer.format = format;
+	buffer.frames = static_cast<size_t>(duration_seconds) * format.rate;
+	buffer.data.assign(chunk_frames * format.frame_bytes(), 0);
 
-   			float faded = static_cast<float>(sample) * gain;
+	return buffer;
+}
 
-   			if (faded > 32767.f) faded = 32767.f;
-   			if (faded < -32768.f) faded = -32768.f;
+pcm_buffer generate_burst(int duration_ms, bool dither, const pcm_format& format) {
+	pcm_buffer buffer = generate_empty_sound(0, format);
+	buffer.frames     = static_cast<size_t>(duration_ms) * format.rate / 1000;
 
-   			samples[idx] = static_cast<int16_t>(faded);
-   		}
-   	}
+	if (dither) {
+		// two 16-bit steps, around -84 dBFS
+		static constexpr float amplitude = 2.f / 32768.f;
+
+		fill_dither(format, buffer.data.data(), buffer.data_frames(), amplitude);
+	}
+
+	return buffer;
 }
 
-std::vector<char> generate_empty_sound(int duration_seconds, int sample_rate, int num_channels, int bits_per_sample) {
-	int byte_rate = sample_rate * num_channels * bits_per_sample / 8;
-	int block_align = num_channels * bits_per_sample / 8;
-	int num_samples = duration_seconds * sample_rate;
-	int data_chunk_size = num_samples * block_align;
-	int fmt_chunk_size = 16;
-	int audio_format = 1; // PCM
-	int riff_chunk_size = 4 + (8 + fmt_chunk_size) + (8 + data_chunk_size);
-
-	std::vector<char> buffer;
-
-	auto write_bytes = [&](const void* data, size_t size) {
-		const char* bytes = static_cast<const char*>(data);
-		buffer.insert(buffer.end(), bytes, bytes + size);
-	};
-
-	auto write_le32 = [&](uint32_t val) {
-		buffer.push_back(static_cast<char>(val & 0xFF));
-		buffer.push_back(static_cast<char>((val >> 8) & 0xFF));
-		buffer.push_back(static_cast<char>((val >> 16) & 0xFF));
-		buffer.push_back(static_cast<char>((val >> 24) & 0xFF));
-	};
-
-	auto write_le16 = [&](uint16_t val) {
-		buffer.push_back(static_cast<char>(val & 0xFF));
-		buffer.push_back(static_cast<char>((val >> 8) & 0xFF));
-	};
-
-	write_bytes("RIFF", 4);
-	write_le32(riff_chunk_size);
-	write_bytes("WAVE", 4);
-
-	write_bytes("fmt ", 4);
-	write_le32(fmt_chunk_size);
-	write_le16(audio_format);
-	write_le16(num_channels);
-	write_le32(sample_rate);
-	write_le32(byte_rate);
-	write_le16(block_align);
-	write_le16(bits_per_sample);
-
-	write_bytes("data", 4);
-	write_le32(data_chunk_size);
-
-	buffer.insert(buffer.end(), data_chunk_size, 0);
+pcm_buffer read_wav(const std::vector<char>& bytes, const pcm_format& target) {
+	pcm_buffer buffer;
+	buffer.format = target;
+
+	if (bytes.size() < 12 || std::memcmp(bytes.data(), "RIFF", 4) != 0 ||
+		std::memcmp(bytes.data() + 8, "WAVE", 4) != 0) {
+		buffer.data   = bytes;
+		buffer.data.resize(bytes.size() - bytes.size() % target.frame_bytes());
+		buffer.frames = buffer.data_frames();
+		return buffer;
+	}
+
+	uint16_t audio_format    = 0;
+	uint16_t channels        = 0;
+	uint32_t sample_rate     = 0;
+	uint16_t bits_per_sample = 0;
+	size_t   data_offset     = 0;
+	size_t   data_size       = 0;
+
+	for (size_t pos = 12; pos + 8 <= bytes.size();) {
+		const uint32_t size = read_le32(bytes, pos + 4);
+		const size_t   body = pos + 8;
+
+		if (std::memcmp(bytes.data() + pos, "fmt ", 4) == 0 && size >= 16 && body + size <= bytes.size()) {
+			audio_format    = read_le16(bytes, body);
+			channels        = read_le16(bytes, body + 2);
+			sample_rate     = read_le32(bytes, body + 4);
+			bits_per_sample = read_le16(bytes, body + 14);
+
+			static constexpr uint16_t extensible = 0xFFFE;
+			if (audio_format == extensible && size >= 26) {
+				audio_format = read_le16(bytes, body + 24); // first two bytes of the sub-format GUID
+			}
+		} else if (std::memcmp(bytes.data() + pos, "data", 4) == 0) {
+			data_offset = body;
+			data_size   = std::min<size_t>(size, bytes.size() - body);
+			break;
+		}
+
+		pos = body + size + (size & 1);
+	}
+
+	if (channels == 0 || sample_rate == 0 || data_offset == 0) {
+		throw std::runtime_error{"Malformed WAV file"};
+	}
+
+	const sample_format source   = wav_sample_format(audio_format, bits_per_sample);
+	const size_t        in_frame = channels * (bits_per_sample / 8);
+	const size_t        frames   = data_size / in_frame;
+	const char*         src      = bytes.data() + data_offset;
+
+	buffer.format.rate = sample_rate;
+	buffer.frames      = frames;
+	buffer.data.resize(frames * buffer.format.frame_bytes());
+
+	if (source == target.format && channels == target.channels() && channels <= 2) {
+		std::memcpy(buffer.data.data(), src, buffer.data.size());
+		return buffer;
+	}
+
+	switch (source) {
+	case sample_format::s16:
+		convert<sample_format::s16>(src, channels, frames, buffer.format, buffer.data.data());
+		break;
+	case sample_format::s24_3le:
+		convert<sample_format::s24_3le>(src, channels, frames, buffer.format, buffer.data.data());
+		break;
+	case sample_format::s32:
+		convert<sample_format::s32>(src, channels, frames, buffer.format, buffer.data.data());
+		break;
+	case sample_format::float32:
+		convert<sample_format::float32>(src, channels, frames, buffer.format, buffer.data.data());
+		break;
+	}
 
 	return buffer;
-}
\ No newline at end of file
+}
+
+pcm_buffer load_wav(const std::string& file_path, const pcm_format& target) {
+	std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		throw std::runtime_error("Failed to open file: " + file_path);
+	}
+
+	std::streamsize size = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	std::vector<char> bytes(size);
+	if (!file.read(bytes.data(), size)) {
+		throw std::runtime_error("Failed to read file: " + file_path);
+	}
+
+	return read_wav(bytes, target);
+}